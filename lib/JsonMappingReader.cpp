@@ -18,18 +18,33 @@
 
 #include "JsonMappingReader.h"
 
+#include "LogMutex.h"
+#include "MqttMetrics.h"
+#include "json-patch.hpp"
 #include "nlohmann/json-schema.hpp"
 
 #include <log/Logger.h>
 
 //
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
-#include <fstream>
+#include <fcntl.h>
+#include <filesystem>
 #include <initializer_list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
 #include <vector>
 
 // IWYU pragma: no_include <nlohmann/detail/json_pointer.hpp>
@@ -41,75 +56,466 @@ namespace mqtt::lib {
     nlohmann::json JsonMappingReader::mappingJsonSchema = nlohmann::json::parse(mappingJsonSchemaString);
 
     nlohmann::json JsonMappingReader::connectionJson;
-    nlohmann::json JsonMappingReader::mappingJson;
+    std::shared_ptr<const nlohmann::json> JsonMappingReader::mappingJson = std::make_shared<const nlohmann::json>();
+    std::shared_ptr<const MqttMetrics::MappedPublishCounters> JsonMappingReader::mappedPublishCounters =
+        std::make_shared<const MqttMetrics::MappedPublishCounters>();
+
+    std::string JsonMappingReader::loadedMapFilePath;
+    std::uint64_t JsonMappingReader::loadedMapFileHash = 0;
+
+    // Top-level topic_level entries are validated concurrently from this number of entries on. All of them are validated against the
+    // same definition and are independent of each other.
+    static constexpr std::size_t concurrentValidationThreshold = 32;
 
     class custom_error_handler : public nlohmann::json_schema::basic_error_handler {
+    public:
+        // Errors of a subtree validated on its own are reported relative to the root of the mapping file
+        explicit custom_error_handler(const nlohmann::json::json_pointer& prefix = nlohmann::json::json_pointer())
+            : prefix(prefix) {
+        }
+
+    private:
         void error(const nlohmann::json::json_pointer& ptr, const nlohmann::json& instance, const std::string& message) override {
             nlohmann::json_schema::basic_error_handler::error(ptr, instance, message);
-            LOG(ERROR) << "ERROR: '" << ptr << "' - '" << instance << "': " << message << "\n";
+
+            const std::scoped_lock<std::mutex> lock(logMutex);
+            LOG(ERROR) << "ERROR: '" << prefix / ptr << "' - '" << instance << "': " << message << "\n";
+        }
+
+        nlohmann::json::json_pointer prefix;
+    };
+
+    static bool isInclude(const nlohmann::json& topicLevel) {
+        return topicLevel.is_object() && topicLevel.contains("$include");
+    }
+
+    // Validates each entry of the array topicLevels against the topic_level definition. If allowed, {"$include": "path"} entries are
+    // accepted instead. From concurrentValidationThreshold entries on they are validated by a pool of threads. The
+    // default patches of the entries are rebased onto prefix/<index> and merged into one patch.
+    static nlohmann::json validateTopicLevels(const nlohmann::json_schema::json_validator& validator,
+                                              const nlohmann::json& topicLevels,
+                                              const std::string& prefix,
+                                              bool allowIncludes,
+                                              bool& valid) {
+        const nlohmann::json_uri topicLevelUri("https://www.vchrist.at/mqttmapper/schemas/topic_level#/$defs/topic_level");
+
+        std::vector<nlohmann::json> patches(topicLevels.size());
+        std::atomic<std::size_t> nextTopicLevel = 0;
+        std::atomic<bool> topicLevelsValid = true;
+
+        auto validateNextTopicLevels = [&]() {
+            for (std::size_t i = nextTopicLevel++; i < topicLevels.size(); i = nextTopicLevel++) {
+                const std::string topicLevelPrefix = prefix + "/" + std::to_string(i);
+
+                try {
+                    custom_error_handler topicLevelErr{nlohmann::json::json_pointer(topicLevelPrefix)};
+
+                    if (!allowIncludes || !isInclude(topicLevels[i])) {
+                        patches[i] = validator.validate(topicLevels[i], topicLevelErr, topicLevelUri);
+                    } else if (topicLevels[i].size() != 1 || !topicLevels[i]["$include"].is_string() ||
+                               topicLevels[i]["$include"].get<std::string>().empty()) {
+                        static_cast<nlohmann::json_schema::error_handler&>(topicLevelErr)
+                            .error(nlohmann::json::json_pointer(),
+                                   topicLevels[i],
+                                   "include needs exactly one non-empty string \"$include\"");
+                    }
+
+                    if (topicLevelErr) {
+                        topicLevelsValid = false;
+                    }
+
+                    for (nlohmann::json& operation : patches[i]) {
+                        operation["path"] = topicLevelPrefix + operation["path"].get<std::string>();
+                    }
+                } catch (const std::exception& e) {
+                    const std::scoped_lock<std::mutex> lock(logMutex);
+                    LOG(ERROR) << "Validating " << topicLevelPrefix << " failed: " << e.what();
+                    topicLevelsValid = false;
+                }
+            }
+        };
+
+        const std::size_t threadCount = std::clamp<std::size_t>(
+            topicLevels.size() / concurrentValidationThreshold, 1, std::max(1U, std::thread::hardware_concurrency()));
+
+        std::vector<std::thread> threads;
+        for (std::size_t i = 1; i < threadCount; i++) {
+            threads.emplace_back(validateNextTopicLevels);
+        }
+        validateNextTopicLevels();
+
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        nlohmann::json defaultPatch = nlohmann::json::array();
+        for (nlohmann::json& patch : patches) {
+            for (nlohmann::json& operation : patch) {
+                defaultPatch.push_back(std::move(operation));
+            }
+        }
+
+        valid = topicLevelsValid;
+
+        return defaultPatch;
+    }
+
+    // Validates mapFileJson and returns the default patch. A large mapping.topic_level array, or one containing includes, is swapped out
+    // of the document, the remaining skeleton is validated as usual and the entries are validated by validateTopicLevels(). Includes
+    // are only allowed in the top-level topic_level, a single include is turned into an array.
+    static nlohmann::json validate(const nlohmann::json_schema::json_validator& validator, nlohmann::json& mapFileJson, bool& valid) {
+        nlohmann::json topicLevels = nlohmann::json::array();
+
+        const auto mapping = mapFileJson.find("mapping");
+        const bool hasTopicLevel = mapping != mapFileJson.end() && mapping->is_object() && mapping->contains("topic_level");
+
+        if (hasTopicLevel && isInclude((*mapping)["topic_level"])) {
+            (*mapping)["topic_level"] = nlohmann::json::array({std::move((*mapping)["topic_level"])});
+        }
+
+        const bool concurrent = hasTopicLevel && (*mapping)["topic_level"].is_array() &&
+                                ((*mapping)["topic_level"].size() >= concurrentValidationThreshold ||
+                                 std::any_of((*mapping)["topic_level"].begin(), (*mapping)["topic_level"].end(), isInclude));
+
+        if (concurrent) {
+            std::swap(topicLevels, (*mapping)["topic_level"]);
+        }
+
+        custom_error_handler err;
+        nlohmann::json defaultPatch = validator.validate(mapFileJson, err);
+
+        if (defaultPatch.is_null()) { // nothing to patch
+            defaultPatch = nlohmann::json::array();
+        }
+
+        valid = !err;
+
+        if (concurrent) {
+            bool topicLevelsValid = false;
+            nlohmann::json topicLevelsPatch = validateTopicLevels(validator, topicLevels, "/mapping/topic_level", true, topicLevelsValid);
+
+            std::swap(topicLevels, (*mapping)["topic_level"]);
+
+            for (nlohmann::json& operation : topicLevelsPatch) {
+                defaultPatch.push_back(std::move(operation));
+            }
+
+            valid = valid && topicLevelsValid;
         }
+
+        return defaultPatch;
+    }
+
+    // Modification time and size of a file. A file whose stamp is unchanged is taken as unchanged without hashing its content.
+    struct FileStamp {
+        std::int64_t seconds = 0;
+        std::int64_t nanoseconds = 0;
+        std::size_t size = 0;
+
+        bool operator==(const FileStamp&) const = default;
     };
 
-    const nlohmann::json JsonMappingReader::readMappingFromFile(const std::string& mapFilePath) {
-        nlohmann::json mapFileJson;
+    // Stamp of the currently loaded mapping file
+    static FileStamp loadedMapFileStamp;
+
+    // Read-only, private mapping of the whole mapping file. The parser consumes the mapped pages directly, thus no stream buffer and
+    // no in-memory copy of the file content is needed. The pages are file backed and can be dropped by the kernel at any time.
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string& path) {
+            fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+            if (fd >= 0) {
+                struct stat st {};
+
+                if (fstat(fd, &st) == 0) {
+                    size = static_cast<std::size_t>(st.st_size);
+                    fileStamp = FileStamp{st.st_mtim.tv_sec, st.st_mtim.tv_nsec, size};
+
+                    if (size > 0) {
+                        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                        if (mapped != MAP_FAILED) {
+                            madvise(mapped, size, MADV_SEQUENTIAL);
+                            data = static_cast<const char*>(mapped);
+                        } else {
+                            PLOG(ERROR) << "Mapping " << path << " into memory failed";
+                        }
+                    }
+                } else {
+                    PLOG(ERROR) << "Stat of " << path << " failed";
+                }
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile() {
+            if (data != nullptr) {
+                munmap(const_cast<char*>(data), size);
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        bool isOpen() const {
+            return fd >= 0;
+        }
+
+        const char* begin() const {
+            return data;
+        }
+
+        const char* end() const {
+            return data + (data != nullptr ? size : 0);
+        }
+
+        FileStamp stamp() const {
+            return fileStamp;
+        }
 
-        std::ifstream mapFile(mapFilePath);
+        // 64 bit FNV-1a hash of the file content
+        std::uint64_t hash() const {
+            std::uint64_t hash = 0xcbf29ce484222325;
+
+            for (const char* c = begin(); c != end(); ++c) {
+                hash = (hash ^ static_cast<unsigned char>(*c)) * 0x100000001b3;
+            }
+
+            return hash;
+        }
+
+    private:
+        int fd = -1;
+        std::size_t size = 0;
+        const char* data = nullptr;
+        FileStamp fileStamp;
+    };
+
+    // A mapping file fragment included by {"$include": "path"} in the top-level mapping.topic_level. Its topic levels are kept validated
+    // and default-patched together with the hash of the file content, thus an unchanged fragment is neither parsed nor validated again.
+    struct MappingFragment {
+        std::uint64_t hash = 0;
+        FileStamp stamp;
+        nlohmann::json topicLevels;
+    };
+
+    // The fragments of the currently loaded mapping file, keyed by their path
+    static std::map<std::string, MappingFragment> mappingFragments;
+
+    // Paths of fragments are relative to the directory of the including mapping file
+    static std::string fragmentPath(const std::string& mapFilePath, const nlohmann::json& include) {
+        return (std::filesystem::path(mapFilePath).parent_path() / include["$include"].get<std::string>()).lexically_normal().string();
+    }
+
+    static bool fragmentsUnchanged() {
+        return std::all_of(mappingFragments.begin(), mappingFragments.end(), [](auto& fragment) {
+            MappedFile fragmentFile(fragment.first);
+
+            const bool unchanged =
+                fragmentFile.isOpen() && (fragmentFile.stamp() == fragment.second.stamp || fragmentFile.hash() == fragment.second.hash);
+
+            if (unchanged) {
+                fragment.second.stamp = fragmentFile.stamp();
+            }
+
+            return unchanged;
+        });
+    }
+
+    static bool readFragment(const nlohmann::json_schema::json_validator& validator,
+                             const std::string& path,
+                             std::map<std::string, MappingFragment>& fragments) {
+        bool success = false;
+
+        MappedFile fragmentFile(path);
+
+        if (fragmentFile.isOpen()) {
+            const std::uint64_t hash = fragmentFile.hash();
+            const auto cached = mappingFragments.find(path);
+
+            if (cached != mappingFragments.end() && cached->second.hash == hash) {
+                fragments[path] = cached->second;
+                fragments[path].stamp = fragmentFile.stamp();
+                success = true;
+            } else {
+                VLOG(0) << "MappingFragmentPath: " << path;
+
+                try {
+                    nlohmann::json topicLevels = nlohmann::json::parse(fragmentFile.begin(), fragmentFile.end());
+
+                    if (!topicLevels.is_array()) {
+                        topicLevels = nlohmann::json::array({std::move(topicLevels)});
+                    }
+
+                    bool valid = false;
+                    nlohmann::json defaultPatch = validateTopicLevels(validator, topicLevels, "", false, valid);
+
+                    if (valid) {
+                        nlohmann::json_patch(defaultPatch).patch_inplace(topicLevels);
+
+                        fragments[path] = MappingFragment{hash, fragmentFile.stamp(), std::move(topicLevels)};
+                        success = true;
+                    } else {
+                        LOG(ERROR) << "JSON schema validating of " << path << " failed.";
+                    }
+                } catch (const nlohmann::json::parse_error& e) {
+                    LOG(ERROR) << "JSON map file fragment " << path << " parsing failed: " << e.what() << " at " << e.byte;
+                } catch (const std::exception& e) {
+                    LOG(ERROR) << "JSON map file fragment " << path << " failed: " << e.what();
+                }
+            }
+        } else {
+            LOG(ERROR) << "MappingFragmentPath: " << path << " not found";
+        }
+
+        return success;
+    }
+
+    // Reads the fragments included by the top-level topic_level array into fragments
+    static bool readFragments(const nlohmann::json_schema::json_validator& validator,
+                              const std::string& mapFilePath,
+                              const nlohmann::json& topicLevels,
+                              std::map<std::string, MappingFragment>& fragments) {
+        bool success = true;
+
+        if (topicLevels.is_array()) {
+            for (const nlohmann::json& topicLevel : topicLevels) {
+                if (success && isInclude(topicLevel)) {
+                    const std::string path = fragmentPath(mapFilePath, topicLevel);
+
+                    success = fragments.contains(path) || readFragment(validator, path, fragments);
+                }
+            }
+        }
+
+        return success;
+    }
+
+    // Replaces the includes of the top-level topic_level array by the topic levels of the fragments
+    static void expandIncludes(nlohmann::json& topicLevels,
+                               const std::string& mapFilePath,
+                               const std::map<std::string, MappingFragment>& fragments) {
+        if (topicLevels.is_array()) {
+            nlohmann::json expandedTopicLevels = nlohmann::json::array();
+
+            for (nlohmann::json& topicLevel : topicLevels) {
+                if (isInclude(topicLevel)) {
+                    for (const nlohmann::json& fragmentTopicLevel : fragments.at(fragmentPath(mapFilePath, topicLevel)).topicLevels) {
+                        expandedTopicLevels.push_back(fragmentTopicLevel);
+                    }
+                } else {
+                    expandedTopicLevels.push_back(std::move(topicLevel));
+                }
+            }
+
+            topicLevels = std::move(expandedTopicLevels);
+        }
+    }
+
+    // Collects the mapped_topic of every static and template mapping
+    static void collectMappedTopics(const nlohmann::json& json, std::vector<std::string>& mappedTopics) {
+        if (json.is_object()) {
+            const auto mappedTopic = json.find("mapped_topic");
+
+            if (mappedTopic != json.end() && mappedTopic->is_string()) {
+                mappedTopics.push_back(mappedTopic->get<std::string>());
+            }
+        }
+
+        if (json.is_structured()) {
+            for (const nlohmann::json& element : json) {
+                collectMappedTopics(element, mappedTopics);
+            }
+        }
+    }
+
+    bool JsonMappingReader::readMappingFromFile(const std::string& mapFilePath) {
+        bool success = false;
+
+        MappedFile mapFile(mapFilePath);
+
+        if (mapFile.isOpen()) {
+            if (mapFilePath == loadedMapFilePath && mapFile.stamp() == loadedMapFileStamp && fragmentsUnchanged()) {
+                return true;
+            }
+
+            const std::uint64_t mapFileHash = mapFile.hash();
+
+            if (mapFilePath == loadedMapFilePath && mapFileHash == loadedMapFileHash && fragmentsUnchanged()) {
+                loadedMapFileStamp = mapFile.stamp();
+
+                return true;
+            }
 
-        if (mapFile.is_open()) {
             VLOG(0) << "MappingFilePath: " << mapFilePath;
 
             try {
-                mapFile >> mapFileJson;
+                nlohmann::json mapFileJson = nlohmann::json::parse(mapFile.begin(), mapFile.end());
 
                 nlohmann::json_schema::json_validator validator(nullptr, nlohmann::json_schema::default_string_format_check);
 
                 try {
                     validator.set_root_schema(mappingJsonSchema);
 
-                    custom_error_handler err;
-                    nlohmann::json defaultPatch = validator.validate(mapFileJson, err);
+                    bool valid = false;
+                    nlohmann::json defaultPatch = validate(validator, mapFileJson, valid);
+
+                    std::map<std::string, MappingFragment> fragments;
 
-                    if (!err) {
+                    if (valid && readFragments(validator, mapFilePath, mapFileJson["mapping"]["topic_level"], fragments)) {
                         try {
-                            mapFileJson = mapFileJson.patch(defaultPatch);
+                            nlohmann::json_patch(defaultPatch).patch_inplace(mapFileJson);
+
+                            expandIncludes(mapFileJson["mapping"]["topic_level"], mapFilePath, fragments);
+
+                            mappingJson = std::make_shared<const nlohmann::json>(std::move(mapFileJson["mapping"]));
+
+                            std::vector<std::string> mappedTopics;
+                            collectMappedTopics(*mappingJson, mappedTopics);
+                            mappedPublishCounters = MqttMetrics::instance().registerMappedTopics(mappedTopics);
+                            connectionJson = std::move(mapFileJson["connection"]);
 
-                            mappingJson = mapFileJson["mapping"];
-                            connectionJson = mapFileJson["connection"];
+                            mappingFragments = std::move(fragments);
+                            loadedMapFilePath = mapFilePath;
+                            loadedMapFileHash = mapFileHash;
+                            loadedMapFileStamp = mapFile.stamp();
+                            success = true;
                         } catch (const std::exception& e) {
                             LOG(ERROR) << e.what();
                             LOG(ERROR) << "Patching JSON with default patch failed:\n" << defaultPatch.dump(4);
-                            mapFileJson.clear();
                         }
                     } else {
                         LOG(ERROR) << "JSON schema validating failed.";
-                        mapFileJson.clear();
                     }
-
                 } catch (const std::exception& e) {
                     LOG(ERROR) << e.what();
                     LOG(ERROR) << "Setting root json mapping schema failed:\n" << mappingJsonSchema.dump(4);
-                    mapFileJson.clear();
                 }
-
-                mapFile.close();
+            } catch (const nlohmann::json::parse_error& e) {
+                LOG(ERROR) << "JSON map file parsing failed: " << e.what() << " at " << e.byte;
             } catch (const std::exception& e) {
-                LOG(ERROR) << "JSON map file parsing failed: " << e.what() << " at " << mapFile.tellg();
-                mapFileJson.clear();
+                LOG(ERROR) << "JSON map file reading failed: " << e.what();
             }
-            mapFile.close();
         } else {
             LOG(INFO) << "MappingFilePath: " << mapFilePath << " not found";
         }
 
-        return mapFileJson;
+        return success;
     }
 
     const nlohmann::json& JsonMappingReader::getConnectionJson() {
         return connectionJson;
     }
 
-    const nlohmann::json& JsonMappingReader::getMappingJson() {
+    const std::shared_ptr<const nlohmann::json>& JsonMappingReader::getMappingJson() {
         return mappingJson;
     }
 
+    const std::shared_ptr<const MqttMetrics::MappedPublishCounters>& JsonMappingReader::getMappedPublishCounters() {
+        return mappedPublishCounters;
+    }
+
 } // namespace mqtt::lib
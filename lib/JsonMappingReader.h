@@ -19,6 +19,12 @@
 #ifndef MQTTBROKER_LIB_JSONMAPPINGREADER_H
 #define MQTTBROKER_LIB_JSONMAPPINGREADER_H
 
+#include "MqttMetrics.h"
+
+//
+
+#include <cstdint>
+#include <memory>
 #include <nlohmann/json_fwd.hpp>
 #include <string>
 
@@ -29,15 +35,31 @@ namespace mqtt::lib {
         JsonMappingReader() = delete;
 
     public:
-        static const nlohmann::json readMappingFromFile(const std::string& mapFilePath);
+        // Reads, validates and default-patches the mapping file. The "mapping" and "connection" sections are moved into the static
+        // members below, thus all factories of a process share one instance. Entries {"$include": "path"} of the top-level topic_level
+        // are replaced by the topic levels of the included fragment files. A file already read is not parsed a second time as long as
+        // neither its content nor the content of one of its fragments has changed, and unchanged fragments are not validated again.
+        // Files whose modification time and size are unchanged are not even read. Thus calling it periodically reloads a changed
+        // mapping file. Must be called on the event loop.
+        static bool readMappingFromFile(const std::string& mapFilePath);
 
         static const nlohmann::json& getConnectionJson();
-        static const nlohmann::json& getMappingJson();
+
+        // The current mapping. A reload replaces it by a new immutable snapshot, thus mappers and queued mapping jobs holding the
+        // previous one keep using it until they switch or complete.
+        static const std::shared_ptr<const nlohmann::json>& getMappingJson();
+
+        // The counters of the mapped topics of the current mapping, replaced together with it
+        static const std::shared_ptr<const MqttMetrics::MappedPublishCounters>& getMappedPublishCounters();
 
     private:
         static nlohmann::json mappingJsonSchema;
         static nlohmann::json connectionJson;
-        static nlohmann::json mappingJson;
+        static std::shared_ptr<const nlohmann::json> mappingJson;
+        static std::shared_ptr<const MqttMetrics::MappedPublishCounters> mappedPublishCounters;
+
+        static std::string loadedMapFilePath;
+        static std::uint64_t loadedMapFileHash;
     };
 
 } // namespace mqtt::lib
@@ -0,0 +1,104 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "LatencyHistogram.h"
+
+//
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+namespace mqtt::lib {
+
+    std::size_t LatencyHistogram::bucketIndex(uint64_t value) {
+        std::size_t index = 0;
+
+        if (value < (1U << subBucketBits)) {
+            index = static_cast<std::size_t>(value);
+        } else {
+            const std::size_t exponent = static_cast<std::size_t>(std::bit_width(value)) - 1;
+            const std::size_t subBucket = static_cast<std::size_t>(value >> (exponent - subBucketBits)) & ((1U << subBucketBits) - 1);
+
+            index = std::min(((exponent - subBucketBits + 1) << subBucketBits) + subBucket, bucketCount - 1);
+        }
+
+        return index;
+    }
+
+    uint64_t LatencyHistogram::bucketUpperBound(std::size_t index) {
+        uint64_t upperBound = index + 1;
+
+        if (index >= (1U << subBucketBits)) {
+            const std::size_t exponent = (index >> subBucketBits) + subBucketBits - 1;
+            const uint64_t subBucket = index & ((1U << subBucketBits) - 1);
+
+            upperBound = ((1U << subBucketBits) + subBucket + 1) << (exponent - subBucketBits);
+        }
+
+        return upperBound;
+    }
+
+    void LatencyHistogram::record(std::chrono::nanoseconds latency) {
+        const uint64_t value = static_cast<uint64_t>(std::max<std::chrono::nanoseconds::rep>(latency.count(), 0));
+
+        buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t currentMax = max.load(std::memory_order_relaxed);
+        while (value > currentMax && !max.compare_exchange_weak(currentMax, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t LatencyHistogram::getCount() const {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    std::chrono::nanoseconds LatencyHistogram::getSum() const {
+        return std::chrono::nanoseconds(sum.load(std::memory_order_relaxed));
+    }
+
+    std::chrono::nanoseconds LatencyHistogram::getMax() const {
+        return std::chrono::nanoseconds(max.load(std::memory_order_relaxed));
+    }
+
+    std::chrono::nanoseconds LatencyHistogram::getQuantile(double quantile) const {
+        uint64_t total = 0;
+        for (const std::atomic<uint64_t>& bucket : buckets) {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+
+        const uint64_t rank = static_cast<uint64_t>(std::ceil(std::clamp(quantile, 0.0, 1.0) * static_cast<double>(total)));
+
+        uint64_t upperBound = 0;
+        uint64_t seen = 0;
+        for (std::size_t index = 0; index < bucketCount && (seen < rank || seen == 0) && total > 0; ++index) {
+            const uint64_t inBucket = buckets[index].load(std::memory_order_relaxed);
+
+            if (inBucket > 0) {
+                seen += inBucket;
+                upperBound = index < bucketCount - 1 ? bucketUpperBound(index) : std::numeric_limits<uint64_t>::max();
+            }
+        }
+
+        return std::chrono::nanoseconds(std::min(upperBound, max.load(std::memory_order_relaxed)));
+    }
+
+} // namespace mqtt::lib
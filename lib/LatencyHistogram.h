@@ -0,0 +1,80 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MQTTBROKER_LIB_LATENCYHISTOGRAM_H
+#define MQTTBROKER_LIB_LATENCYHISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace mqtt::lib {
+
+    // Log-bucketed latency histogram in the spirit of HdrHistogram: each power of two of nanoseconds is split into four sub-buckets,
+    // thus a recorded value is known with a relative error of at most 25%. Recording is a few relaxed atomic increments and can be
+    // done concurrently, reading gives a consistent enough picture for monitoring.
+    class LatencyHistogram {
+    public:
+        void record(std::chrono::nanoseconds latency);
+
+        uint64_t getCount() const;
+        std::chrono::nanoseconds getSum() const;
+        std::chrono::nanoseconds getMax() const;
+
+        // Upper bound of the bucket holding the given quantile (0 <= quantile <= 1)
+        std::chrono::nanoseconds getQuantile(double quantile) const;
+
+    private:
+        static constexpr std::size_t subBucketBits = 2;
+        static constexpr std::size_t maxExponent = 40; // about 18 minutes, longer latencies are recorded in the last bucket
+        static constexpr std::size_t bucketCount = (maxExponent + 1) << subBucketBits;
+
+        static std::size_t bucketIndex(uint64_t value);
+        static uint64_t bucketUpperBound(std::size_t index);
+
+        std::array<std::atomic<uint64_t>, bucketCount> buckets{};
+        std::atomic<uint64_t> count = 0;
+        std::atomic<uint64_t> sum = 0;
+        std::atomic<uint64_t> max = 0;
+    };
+
+    // Records the time from construction to destruction into a histogram
+    class StageTimer {
+    public:
+        explicit StageTimer(LatencyHistogram& latencyHistogram)
+            : latencyHistogram(latencyHistogram)
+            , start(std::chrono::steady_clock::now()) {
+        }
+
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+
+        ~StageTimer() {
+            latencyHistogram.record(std::chrono::steady_clock::now() - start);
+        }
+
+    private:
+        LatencyHistogram& latencyHistogram;
+        std::chrono::steady_clock::time_point start;
+    };
+
+} // namespace mqtt::lib
+
+#endif // MQTTBROKER_LIB_LATENCYHISTOGRAM_H
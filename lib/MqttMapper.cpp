@@ -18,6 +18,8 @@
 
 #include "MqttMapper.h"
 
+#include "LogMutex.h"
+#include "MqttMetrics.h"
 #include "inja.hpp"
 
 #include <iot/mqtt/Topic.h>
@@ -29,8 +31,10 @@
 #include <algorithm>
 #include <initializer_list>
 #include <map>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <stdexcept>
+#include <utility>
 
 // IWYU pragma: no_include <nlohmann/detail/iterators/iteration_proxy.hpp>
 // IWYU pragma: no_include <nlohmann/detail/json_pointer.hpp>
@@ -38,12 +42,26 @@
 
 namespace mqtt::lib {
 
-    MqttMapper::MqttMapper(const nlohmann::json& mappingJson)
-        : mappingJson(mappingJson) {
+    MqttMapper::MqttMapper(std::shared_ptr<const nlohmann::json> mappingJson,
+                           std::shared_ptr<const MqttMetrics::MappedPublishCounters> mappedPublishCounters)
+        : mappingJson(std::move(mappingJson))
+        , mappedPublishCounters(std::move(mappedPublishCounters)) {
     }
 
     std::string MqttMapper::dump() {
-        return mappingJson.dump();
+        return mappingJson->dump();
+    }
+
+    void MqttMapper::setMappingJson(const std::shared_ptr<const nlohmann::json>& mappingJson,
+                                    const std::shared_ptr<const MqttMetrics::MappedPublishCounters>& mappedPublishCounters) {
+        if (this->mappingJson != mappingJson) {
+            this->mappingJson = mappingJson;
+            this->mappedPublishCounters = mappedPublishCounters;
+        }
+    }
+
+    std::unique_lock<std::mutex> MqttMapper::lockLog() const {
+        return offEventLoop ? std::unique_lock<std::mutex>(logMutex) : std::unique_lock<std::mutex>();
     }
 
     void MqttMapper::extractTopic(const nlohmann::json& topicLevel, const std::string& topic, std::list<iot::mqtt::Topic>& topicList) {
@@ -76,7 +94,7 @@ namespace mqtt::lib {
         std::list<iot::mqtt::Topic> topicList;
 
         //        try {
-        extractTopics(mappingJson, "", topicList);
+        extractTopics(*mappingJson, "", topicList);
         //        } catch (const nlohmann::json::exception& e) {
         //            LOG(ERROR) << e.what();
         //            LOG(ERROR) << "Extracting topics failed.";
@@ -87,26 +105,40 @@ namespace mqtt::lib {
 
     void MqttMapper::publishMappedTemplate(const nlohmann::json& templateMapping,
                                            const nlohmann::json& json,
-                                           const iot::mqtt::packets::Publish& publish) {
-        LOG(INFO) << "  -> " << templateMapping["mapped_topic"] << ":" << templateMapping["mapping_template"].dump();
+                                           const MappingSource& publish) {
+        {
+            const std::unique_lock<std::mutex> lock = lockLog();
+            LOG(INFO) << "  -> " << templateMapping["mapped_topic"] << ":" << templateMapping["mapping_template"].dump();
+        }
 
-        const std::string& commandTopic = templateMapping["mapped_topic"];
-        const std::string& mappingTemplate = templateMapping["mapping_template"];
+        const std::string& commandTopic = templateMapping["mapped_topic"].get_ref<const std::string&>();
+        const std::string& mappingTemplate = templateMapping["mapping_template"].get_ref<const std::string&>();
 
         try {
             // Render
-            std::string message = inja::render(mappingTemplate, json);
+            std::string message;
+            {
+                const StageTimer stageTimer(MqttMetrics::instance().latency(MqttMetrics::Stage::RenderTemplate));
+                message = inja::render(mappingTemplate, json);
+            }
 
             bool retain = templateMapping["retain_message"];
             uint8_t qoS = templateMapping.value("qos_override", publish.getQoS());
 
             if (!message.empty()) {
-                LOG(INFO) << "     \"" << publish.getMessage() << "\" -> \"" << message << "\"";
-                LOG(INFO) << "  ... send mapping: \"" << commandTopic << "\":\"" << message << "\"";
+                {
+                    const std::unique_lock<std::mutex> lock = lockLog();
+                    LOG(INFO) << "     \"" << publish.getMessage() << "\" -> \"" << message << "\"";
+                    LOG(INFO) << "  ... send mapping: \"" << commandTopic << "\":\"" << message << "\"";
+                }
 
-                publishMapping(commandTopic, message, qoS, retain);
+                MqttMetrics::instance().mappingPublished(*mappedPublishCounters, commandTopic);
+                publishMapping(commandTopic, Payload(std::move(message)), qoS, retain);
             }
         } catch (const inja::InjaError& e) {
+            MqttMetrics::instance().templateRenderFailed();
+
+            const std::unique_lock<std::mutex> lock = lockLog();
             LOG(ERROR) << e.what();
             LOG(ERROR) << "INJA " << e.type << ": " << e.message;
             LOG(ERROR) << "INJA (line:column):" << e.location.line << ":" << e.location.column;
@@ -116,7 +148,7 @@ namespace mqtt::lib {
 
     void MqttMapper::publishMappedTemplates(const nlohmann::json& templateMapping,
                                             const nlohmann::json& json,
-                                            const iot::mqtt::packets::Publish& publish) {
+                                            const MappingSource& publish) {
         if (templateMapping.is_object()) {
             publishMappedTemplate(templateMapping, json, publish);
         } else {
@@ -126,49 +158,61 @@ namespace mqtt::lib {
         }
     }
 
-    void MqttMapper::publishMappedMessage(const nlohmann::json& staticMapping,
-                                          const std::string& message,
-                                          const iot::mqtt::packets::Publish& publish) {
-        const std::string& commandTopic = staticMapping["mapped_topic"];
+    void MqttMapper::publishMappedMessage(const nlohmann::json& staticMapping, const std::string& message, const MappingSource& publish) {
+        const std::string& commandTopic = staticMapping["mapped_topic"].get_ref<const std::string&>();
         bool retain = staticMapping["retain_message"];
         uint8_t qoS = staticMapping.value("qos_override", publish.getQoS());
 
-        LOG(INFO) << "     \"" << publish.getMessage() << "\" -> \"" << message << "\"";
-        LOG(INFO) << "  ... send mapping: \"" << commandTopic << "\":\"" << message << "\"";
+        {
+            const std::unique_lock<std::mutex> lock = lockLog();
+            LOG(INFO) << "     \"" << publish.getMessage() << "\" -> \"" << message << "\"";
+            LOG(INFO) << "  ... send mapping: \"" << commandTopic << "\":\"" << message << "\"";
+        }
 
-        publishMapping(commandTopic, message, qoS, retain);
+        MqttMetrics::instance().mappingPublished(*mappedPublishCounters, commandTopic);
+        // The mapped message is part of the mapping snapshot, thus the payload shares it instead of copying it
+        publishMapping(commandTopic, Payload(std::shared_ptr<const std::string>(mappingJson, &message)), qoS, retain);
     }
 
-    void MqttMapper::publishMappedMessage(const nlohmann::json& staticMapping, const iot::mqtt::packets::Publish& publish) {
+    void MqttMapper::publishMappedMessage(const nlohmann::json& staticMapping, const MappingSource& publish) {
         const nlohmann::json& messageMapping = staticMapping["message_mapping"];
 
         if (messageMapping.is_object()) {
-            LOG(INFO) << "  -> " << staticMapping["mapped_topic"] << ":" << messageMapping.dump();
+            {
+                const std::unique_lock<std::mutex> lock = lockLog();
+                LOG(INFO) << "  -> " << staticMapping["mapped_topic"] << ":" << messageMapping.dump();
+            }
 
             if (messageMapping["message"] == publish.getMessage()) {
-                publishMappedMessage(staticMapping, messageMapping["mapped_message"], publish);
+                publishMappedMessage(staticMapping, messageMapping["mapped_message"].get_ref<const std::string&>(), publish);
             } else {
+                const std::unique_lock<std::mutex> lock = lockLog();
                 LOG(INFO) << "  ... no matching mapped message found";
             }
         } else {
             const nlohmann::json::const_iterator matchedMessageMappingIterator =
                 std::find_if(messageMapping.begin(),
                              messageMapping.end(),
-                             [&publish, &messageMapping, &staticMapping](const nlohmann::json& messageMappingCandidat) {
-                                 LOG(INFO) << "  -> " << staticMapping["mapped_topic"] << ":" << messageMapping.dump();
+                             [this, &publish, &messageMapping, &staticMapping](const nlohmann::json& messageMappingCandidat) {
+                                 {
+                                     const std::unique_lock<std::mutex> lock = lockLog();
+                                     LOG(INFO) << "  -> " << staticMapping["mapped_topic"] << ":" << messageMapping.dump();
+                                 }
 
                                  return messageMappingCandidat["message"] == publish.getMessage();
                              });
 
             if (matchedMessageMappingIterator != messageMapping.end()) {
-                publishMappedMessage(staticMapping, (*matchedMessageMappingIterator)["mapped_message"], publish);
+                publishMappedMessage(
+                    staticMapping, (*matchedMessageMappingIterator)["mapped_message"].get_ref<const std::string&>(), publish);
             } else {
+                const std::unique_lock<std::mutex> lock = lockLog();
                 LOG(INFO) << "  ... no matching mapped message found";
             }
         }
     }
 
-    void MqttMapper::publishMappedMessages(const nlohmann::json& staticMapping, const iot::mqtt::packets::Publish& publish) {
+    void MqttMapper::publishMappedMessages(const nlohmann::json& staticMapping, const MappingSource& publish) {
         if (staticMapping.is_object()) {
             publishMappedMessage(staticMapping, publish);
         } else if (staticMapping.is_array()) {
@@ -178,8 +222,8 @@ namespace mqtt::lib {
         }
     }
 
-    nlohmann::json MqttMapper::findMatchingTopicLevel(const nlohmann::json& topicLevel, const std::string& topic) {
-        nlohmann::json foundTopicLevel;
+    const nlohmann::json* MqttMapper::findMatchingTopicLevel(const nlohmann::json& topicLevel, const std::string& topic) {
+        const nlohmann::json* foundTopicLevel = nullptr;
 
         if (topicLevel.is_object()) {
             std::string::size_type slashPosition = topic.find("/");
@@ -187,7 +231,7 @@ namespace mqtt::lib {
 
             if (topicLevel["name"] == topicLevelName) {
                 if (slashPosition == std::string::npos) {
-                    foundTopicLevel = topicLevel;
+                    foundTopicLevel = &topicLevel;
                 } else if (topicLevel.contains("topic_level")) {
                     foundTopicLevel = findMatchingTopicLevel(topicLevel["topic_level"], topic.substr(slashPosition + 1));
                 }
@@ -196,7 +240,7 @@ namespace mqtt::lib {
             for (const nlohmann::json& topicLevelEntry : topicLevel) {
                 foundTopicLevel = findMatchingTopicLevel(topicLevelEntry, topic);
 
-                if (!foundTopicLevel.empty()) {
+                if (foundTopicLevel != nullptr) {
                     break;
                 }
             }
@@ -206,35 +250,58 @@ namespace mqtt::lib {
     }
 
     void MqttMapper::publishMappings(const iot::mqtt::packets::Publish& publish) {
-        if (!mappingJson.empty()) {
-            nlohmann::json matchingTopicLevel = findMatchingTopicLevel(mappingJson["topic_level"], publish.getTopic());
+        publishMappings(publish.getTopic(), publish.getMessage(), publish.getQoS());
+    }
+
+    void MqttMapper::publishMappings(const std::string& topic, const std::string& message, uint8_t qoS) {
+        if (!mappingJson->empty()) {
+            const MappingSource publish(topic, message, qoS);
+
+            const nlohmann::json* matchingTopicLevel = nullptr;
+            {
+                const StageTimer stageTimer(MqttMetrics::instance().latency(MqttMetrics::Stage::MatchTopicLevel));
+                matchingTopicLevel = findMatchingTopicLevel((*mappingJson)["topic_level"], publish.getTopic());
+            }
 
-            if (!matchingTopicLevel.empty()) {
-                const nlohmann::json& mapping = matchingTopicLevel["subscription"];
+            if (matchingTopicLevel != nullptr && matchingTopicLevel->contains("subscription")) {
+                const nlohmann::json& mapping = (*matchingTopicLevel)["subscription"];
 
                 if (mapping.contains("static")) {
-                    LOG(INFO) << "Topic mapping (static) found: \"" << publish.getTopic() << "\":\"" << publish.getMessage() << "\"";
+                    {
+                        const std::unique_lock<std::mutex> lock = lockLog();
+                        LOG(INFO) << "Topic mapping (static) found: \"" << publish.getTopic() << "\":\"" << publish.getMessage() << "\"";
+                    }
 
                     publishMappedMessages(mapping["static"], publish);
                 } else {
                     nlohmann::json json;
-                    nlohmann::json templateMapping;
+                    const nlohmann::json* templateMapping = nullptr;
 
                     if (mapping.contains("value")) {
-                        LOG(INFO) << "Topic mapping (value) found: \"" << publish.getTopic() << "\":\"" << publish.getMessage() << "\"";
+                        {
+                            const std::unique_lock<std::mutex> lock = lockLog();
+                            LOG(INFO) << "Topic mapping (value) found: \"" << publish.getTopic() << "\":\"" << publish.getMessage() << "\"";
+                        }
 
-                        templateMapping = mapping["value"];
+                        templateMapping = &mapping["value"];
 
                         json["value"] = publish.getMessage();
 
                     } else if (mapping.contains("json")) {
-                        LOG(INFO) << "Topic mapping (json) found: \"" << publish.getTopic() << "\":\"" << publish.getMessage() << "\"";
+                        {
+                            const std::unique_lock<std::mutex> lock = lockLog();
+                            LOG(INFO) << "Topic mapping (json) found: \"" << publish.getTopic() << "\":\"" << publish.getMessage() << "\"";
+                        }
 
-                        templateMapping = mapping["json"];
+                        templateMapping = &mapping["json"];
 
                         try {
+                            const StageTimer stageTimer(MqttMetrics::instance().latency(MqttMetrics::Stage::ParsePayload));
                             json = nlohmann::json::parse(publish.getMessage());
                         } catch (const nlohmann::json::parse_error& e) {
+                            MqttMetrics::instance().jsonParseFailed();
+
+                            const std::unique_lock<std::mutex> lock = lockLog();
                             LOG(ERROR) << e.what() << ": " << e.id;
                             LOG(ERROR) << "Parsing message into json failed: " << publish.getMessage();
                             LOG(ERROR) << "Parse Error: Message: " << e.what() << '\n'
@@ -245,9 +312,10 @@ namespace mqtt::lib {
                     }
 
                     if (!json.empty()) {
-                        publishMappedTemplates(templateMapping, json, publish);
+                        publishMappedTemplates(*templateMapping, json, publish);
                     } else {
-                        LOG(INFO) << "No valid mapping section found: " << matchingTopicLevel.dump();
+                        const std::unique_lock<std::mutex> lock = lockLog();
+                        LOG(INFO) << "No valid mapping section found: " << matchingTopicLevel->dump();
                     }
                 }
             }
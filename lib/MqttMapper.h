@@ -26,8 +26,15 @@ namespace iot::mqtt {
     }
 } // namespace iot::mqtt
 
+#include "MqttMetrics.h"
+#include "Payload.h" // IWYU pragma: export
+
+//
+
 #include <cstdint>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <nlohmann/json_fwd.hpp> // IWYU pragma: export
 #include <string>
 
@@ -35,40 +42,79 @@ namespace mqtt::lib {
 
     class MqttMapper {
     public:
-        MqttMapper(const nlohmann::json& mappingJson);
+        MqttMapper(std::shared_ptr<const nlohmann::json> mappingJson,
+                   std::shared_ptr<const MqttMetrics::MappedPublishCounters> mappedPublishCounters);
 
         virtual ~MqttMapper() = default;
 
     protected:
         std::string dump();
 
+        // Switches to another snapshot of the mapping and its counters, e.g. after the mapping file has been reloaded
+        void setMappingJson(const std::shared_ptr<const nlohmann::json>& mappingJson,
+                            const std::shared_ptr<const MqttMetrics::MappedPublishCounters>& mappedPublishCounters);
+
         std::list<iot::mqtt::Topic> extractTopics();
         void publishMappings(const iot::mqtt::packets::Publish& publish);
 
+        // Maps a message without a publish packet, e.g. a mapped message which is mapped in turn
+        void publishMappings(const std::string& topic, const std::string& message, uint8_t qoS);
+
     private:
+        // Topic, message and QoS of the message being mapped. Refers to the content of a publish packet or of a mapped message.
+        class MappingSource {
+        public:
+            MappingSource(const std::string& topic, const std::string& message, uint8_t qoS)
+                : topic(topic)
+                , message(message)
+                , qoS(qoS) {
+            }
+
+            const std::string& getTopic() const {
+                return topic;
+            }
+
+            const std::string& getMessage() const {
+                return message;
+            }
+
+            uint8_t getQoS() const {
+                return qoS;
+            }
+
+        private:
+            const std::string& topic;
+            const std::string& message;
+            uint8_t qoS;
+        };
+
         static void extractTopic(const nlohmann::json& json, const std::string& topic, std::list<iot::mqtt::Topic>& topicList);
         static void extractTopics(const nlohmann::json& json, const std::string& topic, std::list<iot::mqtt::Topic>& topicList);
 
-        nlohmann::json findMatchingTopicLevel(const nlohmann::json& topicLevel, const std::string& topic);
+        // Returns the matching topic level inside the mapping, or nullptr
+        static const nlohmann::json* findMatchingTopicLevel(const nlohmann::json& topicLevel, const std::string& topic);
+
+        void publishMappedTemplate(const nlohmann::json& mappingSubJson, const nlohmann::json& json, const MappingSource& publish);
+        void publishMappedTemplates(const nlohmann::json& mappingSubJson, const nlohmann::json& json, const MappingSource& publish);
 
-        void
-        publishMappedTemplate(const nlohmann::json& mappingSubJson, const nlohmann::json& json, const iot::mqtt::packets::Publish& publish);
-        void publishMappedTemplates(const nlohmann::json& mappingSubJson,
-                                    const nlohmann::json& json,
-                                    const iot::mqtt::packets::Publish& publish);
+        void publishMappedMessage(const nlohmann::json& staticMapping, const std::string& message, const MappingSource& publish);
 
-        void publishMappedMessage(const nlohmann::json& staticMapping,
-                                  const std::string &message,
-                                  const iot::mqtt::packets::Publish& publish);
+        void publishMappedMessage(const nlohmann::json& staticMapping, const MappingSource& publish);
 
-        void publishMappedMessage(const nlohmann::json& staticMapping, const iot::mqtt::packets::Publish& publish);
+        void publishMappedMessages(const nlohmann::json& staticMapping, const MappingSource& publish);
 
-        void publishMappedMessages(const nlohmann::json& staticMapping, const iot::mqtt::packets::Publish& publish);
+        virtual void publishMapping(const std::string& topic, const Payload& message, uint8_t qoS, bool retain) = 0;
 
-        virtual void publishMapping(const std::string& topic, const std::string& message, uint8_t qoS, bool retain) = 0;
+        // Locks logMutex only if the mapper runs off the event loop
+        std::unique_lock<std::mutex> lockLog() const;
 
     protected:
-        const nlohmann::json& mappingJson;
+        std::shared_ptr<const nlohmann::json> mappingJson;
+        std::shared_ptr<const MqttMetrics::MappedPublishCounters> mappedPublishCounters;
+
+        // Set by mappers running on threads of the mapping worker pool. The event loop maps itself only while the pool is stopped,
+        // thus its mappers log without taking logMutex.
+        bool offEventLoop = false;
     };
 
 } // namespace mqtt::lib
@@ -0,0 +1,238 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MqttMetrics.h"
+
+//
+
+#include <algorithm>
+#include <initializer_list>
+#include <sstream>
+#include <utility>
+
+namespace mqtt::lib {
+
+    static std::string escapeLabelValue(const std::string& value) {
+        std::string escaped;
+        escaped.reserve(value.size());
+
+        for (const char c : value) {
+            switch (c) {
+                case '\\':
+                    escaped += "\\\\";
+                    break;
+                case '"':
+                    escaped += "\\\"";
+                    break;
+                case '\n':
+                    escaped += "\\n";
+                    break;
+                default:
+                    escaped += c;
+                    break;
+            }
+        }
+
+        return escaped;
+    }
+
+    static void addMetric(std::ostringstream& out, const std::string& name, const std::string& type, const std::string& help) {
+        out << "# HELP " << name << " " << help << "\n"
+            << "# TYPE " << name << " " << type << "\n";
+    }
+
+    MqttMetrics& MqttMetrics::instance() {
+        static MqttMetrics mqttMetrics;
+
+        return mqttMetrics;
+    }
+
+    void MqttMetrics::publishReceived(std::size_t bytes) {
+        publishesReceived.fetch_add(1, std::memory_order_relaxed);
+        bytesReceived.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void MqttMetrics::publishSent(std::size_t bytes) {
+        publishesSent.fetch_add(1, std::memory_order_relaxed);
+        bytesSent.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    std::shared_ptr<const MqttMetrics::MappedPublishCounters>
+    MqttMetrics::registerMappedTopics(const std::vector<std::string>& mappedTopics) {
+        const std::scoped_lock<std::mutex> lock(mappedPublishesMutex);
+
+        auto counters = std::make_shared<MappedPublishCounters>();
+        for (const std::string& mappedTopic : mappedTopics) {
+            counters->emplace(mappedTopic, &mappedPublishes.try_emplace(mappedTopic, 0).first->second);
+        }
+
+        return counters;
+    }
+
+    void MqttMetrics::mappingPublished(const MappedPublishCounters& mappedPublishCounters, const std::string& mappedTopic) {
+        const auto it = mappedPublishCounters.find(mappedTopic);
+
+        if (it != mappedPublishCounters.end()) {
+            it->second->fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void MqttMetrics::templateRenderFailed() {
+        templateRenderErrors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void MqttMetrics::jsonParseFailed() {
+        jsonParseErrors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void MqttMetrics::mappingDropped(std::size_t count) {
+        mappingsDropped.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void MqttMetrics::connectionRejected() {
+        connectionsRejected.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t MqttMetrics::getPublishesReceived() const {
+        return publishesReceived.load(std::memory_order_relaxed);
+    }
+
+    uint64_t MqttMetrics::getPublishesSent() const {
+        return publishesSent.load(std::memory_order_relaxed);
+    }
+
+    uint64_t MqttMetrics::getBytesReceived() const {
+        return bytesReceived.load(std::memory_order_relaxed);
+    }
+
+    uint64_t MqttMetrics::getBytesSent() const {
+        return bytesSent.load(std::memory_order_relaxed);
+    }
+
+    LatencyHistogram& MqttMetrics::latency(Stage stage) {
+        return latencies[static_cast<std::size_t>(stage)];
+    }
+
+    const LatencyHistogram& MqttMetrics::latency(Stage stage) const {
+        return latencies[static_cast<std::size_t>(stage)];
+    }
+
+    const char* MqttMetrics::stageName(Stage stage) {
+        const char* name = "unknown";
+
+        switch (stage) {
+            case Stage::OnPublish:
+                name = "on_publish";
+                break;
+            case Stage::MatchTopicLevel:
+                name = "match_topic_level";
+                break;
+            case Stage::ParsePayload:
+                name = "parse_payload";
+                break;
+            case Stage::RenderTemplate:
+                name = "render_template";
+                break;
+            case Stage::BrokerPublish:
+                name = "broker_publish";
+                break;
+            case Stage::Count:
+                break;
+        }
+
+        return name;
+    }
+
+    void MqttMetrics::updateRates(std::chrono::nanoseconds elapsed, std::chrono::nanoseconds interval) {
+        const double seconds = std::chrono::duration<double>(elapsed).count();
+
+        if (seconds > 0) {
+            const uint64_t received = publishesReceived.load(std::memory_order_relaxed);
+            const uint64_t sent = publishesSent.load(std::memory_order_relaxed);
+
+            publishesReceivedPerSecond.store(static_cast<double>(received - lastPublishesReceived) / seconds, std::memory_order_relaxed);
+            publishesSentPerSecond.store(static_cast<double>(sent - lastPublishesSent) / seconds, std::memory_order_relaxed);
+
+            lastPublishesReceived = received;
+            lastPublishesSent = sent;
+        }
+
+        const int64_t lag = std::max<int64_t>((elapsed - interval).count(), 0);
+        eventLoopLag.store(lag, std::memory_order_relaxed);
+        eventLoopLagMax.store(std::max(lag, eventLoopLagMax.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+    }
+
+    std::string MqttMetrics::toPrometheus() const {
+        std::ostringstream out;
+
+        addMetric(out, "mqtt_publishes_received_total", "counter", "Publish packets received from clients.");
+        out << "mqtt_publishes_received_total " << publishesReceived.load(std::memory_order_relaxed) << "\n";
+        addMetric(out, "mqtt_publishes_sent_total", "counter", "Mapped publish packets sent.");
+        out << "mqtt_publishes_sent_total " << publishesSent.load(std::memory_order_relaxed) << "\n";
+        addMetric(out, "mqtt_publishes_received_per_second", "gauge", "Publish packets received during the last second.");
+        out << "mqtt_publishes_received_per_second " << publishesReceivedPerSecond.load(std::memory_order_relaxed) << "\n";
+        addMetric(out, "mqtt_publishes_sent_per_second", "gauge", "Mapped publish packets sent during the last second.");
+        out << "mqtt_publishes_sent_per_second " << publishesSentPerSecond.load(std::memory_order_relaxed) << "\n";
+        addMetric(out, "mqtt_received_bytes_total", "counter", "Topic and payload bytes of the received publish packets.");
+        out << "mqtt_received_bytes_total " << bytesReceived.load(std::memory_order_relaxed) << "\n";
+        addMetric(out, "mqtt_sent_bytes_total", "counter", "Topic and payload bytes of the sent mapped publish packets.");
+        out << "mqtt_sent_bytes_total " << bytesSent.load(std::memory_order_relaxed) << "\n";
+
+        addMetric(out, "mqtt_mapping_errors_total", "counter", "Failed mappings.");
+        out << "mqtt_mapping_errors_total{type=\"template\"} " << templateRenderErrors.load(std::memory_order_relaxed) << "\n"
+            << "mqtt_mapping_errors_total{type=\"json_parse\"} " << jsonParseErrors.load(std::memory_order_relaxed) << "\n";
+
+        addMetric(out, "mqtt_mapping_dropped_total", "counter", "Publishes not mapped because a mapping queue was full.");
+        out << "mqtt_mapping_dropped_total " << mappingsDropped.load(std::memory_order_relaxed) << "\n";
+
+        addMetric(out, "mqtt_connections_rejected_total", "counter", "Connections closed by the admission control.");
+        out << "mqtt_connections_rejected_total " << connectionsRejected.load(std::memory_order_relaxed) << "\n";
+
+        addMetric(out, "mqtt_mapped_publishes_total", "counter", "Mapped publish packets per mapped topic.");
+        {
+            const std::scoped_lock<std::mutex> lock(mappedPublishesMutex);
+
+            for (const auto& [mappedTopic, count] : mappedPublishes) {
+                out << "mqtt_mapped_publishes_total{mapped_topic=\"" << escapeLabelValue(mappedTopic) << "\"} "
+                    << count.load(std::memory_order_relaxed) << "\n";
+            }
+        }
+
+        addMetric(out, "mqtt_stage_latency_seconds", "summary", "Latency of the stages of the publish path.");
+        for (std::size_t index = 0; index < latencies.size(); ++index) {
+            const LatencyHistogram& latencyHistogram = latencies[index];
+            const std::string stage = stageName(static_cast<Stage>(index));
+
+            for (const double quantile : {0.5, 0.9, 0.99, 1.0}) {
+                out << "mqtt_stage_latency_seconds{stage=\"" << stage << "\",quantile=\"" << quantile << "\"} "
+                    << std::chrono::duration<double>(latencyHistogram.getQuantile(quantile)).count() << "\n";
+            }
+            out << "mqtt_stage_latency_seconds_sum{stage=\"" << stage << "\"} "
+                << std::chrono::duration<double>(latencyHistogram.getSum()).count() << "\n"
+                << "mqtt_stage_latency_seconds_count{stage=\"" << stage << "\"} " << latencyHistogram.getCount() << "\n";
+        }
+
+        addMetric(out, "mqtt_event_loop_lag_seconds", "gauge", "Delay of the last tick of the one second event loop timer.");
+        out << "mqtt_event_loop_lag_seconds " << static_cast<double>(eventLoopLag.load(std::memory_order_relaxed)) / 1e9 << "\n";
+        addMetric(out, "mqtt_event_loop_lag_max_seconds", "gauge", "Largest delay of the one second event loop timer.");
+        out << "mqtt_event_loop_lag_max_seconds " << static_cast<double>(eventLoopLagMax.load(std::memory_order_relaxed)) / 1e9 << "\n";
+
+        return out.str();
+    }
+
+} // namespace mqtt::lib
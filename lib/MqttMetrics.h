@@ -0,0 +1,116 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MQTTBROKER_LIB_MQTTMETRICS_H
+#define MQTTBROKER_LIB_MQTTMETRICS_H
+
+#include "LatencyHistogram.h" // IWYU pragma: export
+
+//
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mqtt::lib {
+
+    // Process wide counters of the publish and mapping path. The counters are relaxed atomics as they are updated for every message
+    // but only read by a scrape. Rates are derived once per second by updateRates() which is driven by a timer of the event loop.
+    class MqttMetrics {
+    public:
+        // Stages of the publish path, each timed into its own latency histogram
+        enum class Stage : std::size_t {
+            OnPublish,       // handling of a received publish including all of the stages below
+            MatchTopicLevel, // findMatchingTopicLevel()
+            ParsePayload,    // parsing of the payload of a json mapping
+            RenderTemplate,  // inja rendering of a template mapping
+            BrokerPublish,   // broker->publish() of a mapped message, i.e. the fan-out to the subscribers
+            Count
+        };
+
+    private:
+        MqttMetrics() = default;
+
+    public:
+        static MqttMetrics& instance();
+
+        void publishReceived(std::size_t bytes);
+        void publishSent(std::size_t bytes);
+
+        using MappedPublishCounters = std::unordered_map<std::string, std::atomic<uint64_t>*>;
+
+        // Creates the counters of the mapped topics of a loaded mapping. Counting a mapped publish is then a lock-free lookup in the
+        // immutable table, publishes to topics not in it are not counted. The table is owned by the mappers using the mapping, thus
+        // the table of a replaced mapping is released together with its last mapper.
+        std::shared_ptr<const MappedPublishCounters> registerMappedTopics(const std::vector<std::string>& mappedTopics);
+        void mappingPublished(const MappedPublishCounters& mappedPublishCounters, const std::string& mappedTopic);
+        void templateRenderFailed();
+        void jsonParseFailed();
+        void mappingDropped(std::size_t count);
+        void connectionRejected();
+
+        uint64_t getPublishesReceived() const;
+        uint64_t getPublishesSent() const;
+        uint64_t getBytesReceived() const;
+        uint64_t getBytesSent() const;
+
+        LatencyHistogram& latency(Stage stage);
+        const LatencyHistogram& latency(Stage stage) const;
+        static const char* stageName(Stage stage);
+
+        // Called once per tick of the lag timer: elapsed is the measured time since the last tick, interval the timer interval
+        void updateRates(std::chrono::nanoseconds elapsed, std::chrono::nanoseconds interval);
+
+        // The counters in the Prometheus text exposition format
+        std::string toPrometheus() const;
+
+    private:
+        std::atomic<uint64_t> publishesReceived = 0;
+        std::atomic<uint64_t> publishesSent = 0;
+        std::atomic<uint64_t> bytesReceived = 0;
+        std::atomic<uint64_t> bytesSent = 0;
+        std::atomic<uint64_t> templateRenderErrors = 0;
+        std::atomic<uint64_t> jsonParseErrors = 0;
+        std::atomic<uint64_t> mappingsDropped = 0;
+        std::atomic<uint64_t> connectionsRejected = 0;
+
+        std::atomic<double> publishesReceivedPerSecond = 0;
+        std::atomic<double> publishesSentPerSecond = 0;
+        std::atomic<int64_t> eventLoopLag = 0;
+        std::atomic<int64_t> eventLoopLagMax = 0;
+
+        uint64_t lastPublishesReceived = 0;
+        uint64_t lastPublishesSent = 0;
+
+        std::array<LatencyHistogram, static_cast<std::size_t>(Stage::Count)> latencies;
+
+        mutable std::mutex mappedPublishesMutex; // guards registering and scraping, not counting
+        std::map<std::string, std::atomic<uint64_t>> mappedPublishes; // never erased, thus the counters do not move
+    };
+
+} // namespace mqtt::lib
+
+#endif // MQTTBROKER_LIB_MQTTMETRICS_H
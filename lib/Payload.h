@@ -0,0 +1,68 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MQTTBROKER_LIB_PAYLOAD_H
+#define MQTTBROKER_LIB_PAYLOAD_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace mqtt::lib {
+
+    // Immutable reference counted message payload. Copies share one buffer, thus a mapped message can be queued, forwarded to other
+    // workers and mapped in turn without copying its content. Converts to const std::string& for the APIs taking a plain string.
+    class Payload {
+    public:
+        Payload()
+            : Payload(std::string()) {
+        }
+
+        explicit Payload(std::string message)
+            : message(std::make_shared<const std::string>(std::move(message))) {
+        }
+
+        // Shares a message owned by someone else, e.g. by an aliasing shared_ptr into the mapping snapshot holding it
+        explicit Payload(std::shared_ptr<const std::string> message)
+            : message(std::move(message)) {
+        }
+
+        const std::string& str() const {
+            return *message;
+        }
+
+        operator const std::string&() const { // NOLINT(google-explicit-constructor)
+            return *message;
+        }
+
+        std::size_t size() const {
+            return message->size();
+        }
+
+        bool empty() const {
+            return message->empty();
+        }
+
+    private:
+        std::shared_ptr<const std::string> message;
+    };
+
+} // namespace mqtt::lib
+
+#endif // MQTTBROKER_LIB_PAYLOAD_H
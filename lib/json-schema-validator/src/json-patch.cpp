@@ -101,6 +101,99 @@ json_patch &json_patch::remove(const json::json_pointer &ptr)
 	return *this;
 }
 
+namespace
+{
+
+std::size_t array_index(const json &array, const std::string &token, bool allow_end)
+{
+	if (allow_end && token == "-")
+		return array.size();
+
+	if (token.empty() || token.find_first_not_of("0123456789") != std::string::npos || (token.size() > 1 && token[0] == '0'))
+		throw JsonPatchFormatException("array index '" + token + "' is not a number");
+
+	std::size_t index = std::stoul(token);
+	if (index > array.size() || (!allow_end && index == array.size()))
+		throw JsonPatchFormatException("array index " + token + " is out of range");
+
+	return index;
+}
+
+void apply_add(json &document, json::json_pointer ptr, json value)
+{
+	if (ptr.empty()) {
+		document = std::move(value);
+		return;
+	}
+
+	const std::string last = ptr.back();
+	ptr.pop_back();
+
+	json &parent = document.at(ptr); // parent must exist
+
+	if (parent.is_array())
+		parent.insert(parent.begin() + static_cast<json::difference_type>(array_index(parent, last, true)), std::move(value));
+	else if (parent.is_object())
+		parent[last] = std::move(value);
+	else
+		throw JsonPatchFormatException("parent of " + ptr.to_string() + "/" + last + " is neither an object nor an array");
+}
+
+json apply_remove(json &document, json::json_pointer ptr)
+{
+	if (ptr.empty())
+		return std::move(document);
+
+	const std::string last = ptr.back();
+	ptr.pop_back();
+
+	json &parent = document.at(ptr);
+	json removed;
+
+	if (parent.is_array()) {
+		auto it = parent.begin() + static_cast<json::difference_type>(array_index(parent, last, false));
+		removed = std::move(*it);
+		parent.erase(it);
+	} else if (parent.is_object()) {
+		auto it = parent.find(last);
+		if (it == parent.end())
+			throw JsonPatchFormatException("key '" + last + "' not found in " + ptr.to_string());
+		removed = std::move(*it);
+		parent.erase(it);
+	} else
+		throw JsonPatchFormatException("parent of " + ptr.to_string() + "/" + last + " is neither an object nor an array");
+
+	return removed;
+}
+
+} // namespace
+
+void json_patch::patch_inplace(json &document) const
+{
+	for (auto const &op : j_) {
+		const std::string &operation = op["op"].get_ref<const std::string &>();
+		const json::json_pointer path(op["path"].get<std::string>());
+
+		if (operation == "add")
+			apply_add(document, path, op["value"]);
+		else if (operation == "replace")
+			document.at(path) = op["value"];
+		else if (operation == "remove")
+			apply_remove(document, path);
+		else if (operation == "test") {
+			if (document.at(path) != op["value"])
+				throw JsonPatchFormatException("unsuccessful: " + op.dump());
+		} else if (operation == "move") {
+			const json::json_pointer from(op["from"].get<std::string>());
+			apply_add(document, path, apply_remove(document, from));
+		} else if (operation == "copy") {
+			const json::json_pointer from(op["from"].get<std::string>());
+			apply_add(document, path, document.at(from));
+		} else
+			throw JsonPatchFormatException("unknown operation '" + operation + "'");
+	}
+}
+
 void json_patch::validateJsonPatch(json const &patch)
 {
 	// static put here to have it created at the first usage of validateJsonPatch
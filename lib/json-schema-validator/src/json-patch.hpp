@@ -28,6 +28,9 @@ public:
 	json_patch &replace(const json::json_pointer &, json value);
 	json_patch &remove(const json::json_pointer &);
 
+	// apply this patch directly to document - in contrast to json::patch() no copy of the document is created
+	void patch_inplace(json &document) const;
+
 	operator json() const { return j_; }
 
 private:
@@ -0,0 +1,697 @@
+/*
+ * JSON schema validator for JSON for modern C++
+ *
+ * Copyright (c) 2016-2019 Patrick Boettcher <p@yai.se>.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ */
+#include "json-pattern.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#ifdef JSON_SCHEMA_BOOST_REGEX
+#	include <boost/regex.hpp>
+#	define REGEX_NAMESPACE boost
+#elif defined(JSON_SCHEMA_NO_REGEX)
+#	define NO_STD_REGEX
+#else
+#	include <regex>
+#	define REGEX_NAMESPACE std
+#endif
+
+namespace
+{
+
+using charset = std::bitset<256>;
+
+const std::size_t unbounded = static_cast<std::size_t>(-1);
+
+// limits above which a pattern is handed over to the regex-engine or matched by NFA-simulation
+const std::size_t max_repeat = 1000;
+const std::size_t max_nfa_states = 20000;
+const std::size_t max_dfa_states = 4096;
+
+// thrown by the parser for everything outside of the supported subset
+struct unsupported {
+};
+
+struct node {
+	enum kind_t {
+		chars,
+		bol,
+		eol,
+		concat,
+		alternate,
+		repeat
+	} kind;
+
+	charset set;
+	std::vector<node> children;
+	std::size_t min = 0;
+	std::size_t max = 0;
+
+	explicit node(kind_t k)
+	    : kind(k) {}
+};
+
+charset class_escape(char c)
+{
+	charset set;
+
+	for (int i = 0; i < 256; i++) {
+		bool in = false;
+
+		switch (c) {
+		case 'd':
+		case 'D':
+			in = i >= '0' && i <= '9';
+			break;
+		case 'w':
+		case 'W':
+			in = (i >= '0' && i <= '9') || (i >= 'a' && i <= 'z') || (i >= 'A' && i <= 'Z') || i == '_';
+			break;
+		case 's':
+		case 'S':
+			in = i == ' ' || (i >= '\t' && i <= '\r');
+			break;
+		}
+
+		set[static_cast<std::size_t>(i)] = in;
+	}
+
+	if (c == 'D' || c == 'W' || c == 'S')
+		set.flip();
+
+	return set;
+}
+
+bool is_class_escape(char c)
+{
+	return c == 'd' || c == 'D' || c == 'w' || c == 'W' || c == 's' || c == 'S';
+}
+
+// single character escapes: control characters and escaped ASCII punctuation
+bool char_escape(char c, unsigned char &out)
+{
+	switch (c) {
+	case 'n':
+		out = '\n';
+		return true;
+	case 't':
+		out = '\t';
+		return true;
+	case 'r':
+		out = '\r';
+		return true;
+	case 'f':
+		out = '\f';
+		return true;
+	case 'v':
+		out = '\v';
+		return true;
+	}
+
+	const unsigned char u = static_cast<unsigned char>(c);
+	if ((u >= 0x21 && u <= 0x2f) || (u >= 0x3a && u <= 0x40) || (u >= 0x5b && u <= 0x60) || (u >= 0x7b && u <= 0x7e)) {
+		out = u;
+		return true;
+	}
+
+	return false;
+}
+
+class parser
+{
+	const std::string &p_;
+	std::size_t pos_ = 0;
+
+	bool at_end() const { return pos_ >= p_.size(); }
+	char peek() const { return p_[pos_]; }
+
+	node alternation()
+	{
+		node alt(node::alternate);
+
+		alt.children.push_back(concatenation());
+		while (!at_end() && peek() == '|') {
+			pos_++;
+			alt.children.push_back(concatenation());
+		}
+
+		if (alt.children.size() == 1)
+			return std::move(alt.children.front());
+
+		return alt;
+	}
+
+	node concatenation()
+	{
+		node cat(node::concat);
+
+		while (!at_end() && peek() != '|' && peek() != ')')
+			cat.children.push_back(quantified());
+
+		if (cat.children.empty()) // empty alternatives and groups
+			throw unsupported();
+
+		return cat;
+	}
+
+	std::size_t number()
+	{
+		std::size_t n = 0;
+		std::size_t digits = 0;
+
+		while (!at_end() && peek() >= '0' && peek() <= '9') {
+			n = n * 10 + static_cast<std::size_t>(peek() - '0');
+			pos_++;
+			if (++digits > 4)
+				throw unsupported();
+		}
+
+		if (digits == 0)
+			throw unsupported();
+
+		return n;
+	}
+
+	node quantified()
+	{
+		node atom_node = atom();
+
+		if (at_end())
+			return atom_node;
+
+		std::size_t min = 0, max = 0;
+
+		switch (peek()) {
+		case '*':
+			min = 0, max = unbounded;
+			pos_++;
+			break;
+		case '+':
+			min = 1, max = unbounded;
+			pos_++;
+			break;
+		case '?':
+			min = 0, max = 1;
+			pos_++;
+			break;
+		case '{':
+			pos_++;
+			min = max = number();
+			if (!at_end() && peek() == ',') {
+				pos_++;
+				max = (!at_end() && peek() == '}') ? unbounded : number();
+			}
+			if (at_end() || peek() != '}' || min > max || min > max_repeat || (max != unbounded && max > max_repeat))
+				throw unsupported();
+			pos_++;
+			break;
+		default:
+			return atom_node;
+		}
+
+		if (atom_node.kind == node::bol || atom_node.kind == node::eol)
+			throw unsupported();
+
+		if (!at_end() && peek() == '?') // lazy - has no influence on whether there is a match
+			pos_++;
+
+		if (!at_end() && (peek() == '*' || peek() == '+' || peek() == '?' || peek() == '{'))
+			throw unsupported();
+
+		node rep(node::repeat);
+		rep.min = min;
+		rep.max = max;
+		rep.children.push_back(std::move(atom_node));
+
+		return rep;
+	}
+
+	node atom()
+	{
+		const char c = peek();
+		pos_++;
+
+		switch (c) {
+		case '(': {
+			if (!at_end() && peek() == '?') {
+				if (pos_ + 1 < p_.size() && p_[pos_ + 1] == ':')
+					pos_ += 2;
+				else
+					throw unsupported(); // look-arounds
+			}
+
+			node group = alternation();
+			if (at_end() || peek() != ')')
+				throw unsupported();
+			pos_++;
+
+			return group;
+		}
+		case '[':
+			return bracket();
+		case '.': {
+			node any(node::chars);
+			any.set.set();
+			any.set.reset('\n');
+			any.set.reset('\r');
+			return any;
+		}
+		case '^':
+			return node(node::bol);
+		case '$':
+			return node(node::eol);
+		case '\\': {
+			if (at_end())
+				throw unsupported();
+
+			const char e = p_[pos_++];
+			node escaped(node::chars);
+			unsigned char u;
+
+			if (is_class_escape(e))
+				escaped.set = class_escape(e);
+			else if (char_escape(e, u))
+				escaped.set.set(u);
+			else
+				throw unsupported(); // back-references, \b, \B, \x, \u, \c, \0, ...
+
+			return escaped;
+		}
+		case ')':
+		case ']':
+		case '{':
+		case '}':
+		case '*':
+		case '+':
+		case '?':
+		case '|':
+			throw unsupported();
+		default: {
+			node literal(node::chars);
+			literal.set.set(static_cast<unsigned char>(c));
+			return literal;
+		}
+		}
+	}
+
+	// one element of a bracket expression: false for class escapes like \d
+	bool bracket_char(charset &set, unsigned char &c)
+	{
+		if (at_end())
+			throw unsupported();
+
+		const char n = p_[pos_++];
+
+		if (static_cast<unsigned char>(n) >= 0x80 || n == '[')
+			throw unsupported();
+
+		if (n != '\\') {
+			c = static_cast<unsigned char>(n);
+			return true;
+		}
+
+		if (at_end())
+			throw unsupported();
+
+		const char e = p_[pos_++];
+
+		if (is_class_escape(e)) {
+			set |= class_escape(e);
+			return false;
+		}
+
+		if (!char_escape(e, c))
+			throw unsupported();
+
+		return true;
+	}
+
+	node bracket()
+	{
+		node cls(node::chars);
+		bool negate = false;
+
+		if (!at_end() && peek() == '^') {
+			negate = true;
+			pos_++;
+		}
+
+		if (at_end() || peek() == ']') // [] and [^]
+			throw unsupported();
+
+		while (!at_end() && peek() != ']') {
+			unsigned char first;
+			const bool is_char = bracket_char(cls.set, first);
+			const bool is_range = !at_end() && peek() == '-' && pos_ + 1 < p_.size() && p_[pos_ + 1] != ']';
+
+			if (!is_char) {
+				if (is_range) // [\d-z] is an error for ECMAScript
+					throw unsupported();
+				continue;
+			}
+
+			if (is_range) {
+				pos_++;
+
+				unsigned char last;
+				if (!bracket_char(cls.set, last) || last < first)
+					throw unsupported();
+
+				for (unsigned i = first; i <= last; i++)
+					cls.set.set(i);
+
+				if (!at_end() && peek() == '-' && pos_ + 1 < p_.size() && p_[pos_ + 1] != ']')
+					throw unsupported();
+			} else
+				cls.set.set(first);
+		}
+
+		if (at_end())
+			throw unsupported();
+		pos_++;
+
+		if (negate)
+			cls.set.flip();
+
+		return cls;
+	}
+
+public:
+	explicit parser(const std::string &p)
+	    : p_(p) {}
+
+	node parse()
+	{
+		if (p_.empty()) // matches everywhere
+			return node(node::concat);
+
+		node root = alternation();
+		if (!at_end())
+			throw unsupported();
+
+		return root;
+	}
+};
+
+} // namespace
+
+namespace nlohmann
+{
+
+struct json_pattern::program {
+	struct state {
+		enum kind_t : std::uint8_t {
+			chars,
+			split,
+			bol,
+			eol,
+			match
+		} kind;
+
+		std::size_t set = 0;
+		std::size_t out = 0;
+		std::size_t out1 = 0;
+	};
+
+	// the NFA
+	std::vector<state> nfa;
+	std::vector<charset> sets;
+	std::size_t start = 0;
+
+	// the DFA, empty if it got too large
+	std::vector<std::uint16_t> byte_class = std::vector<std::uint16_t>(256, 0);
+	std::size_t classes = 0;
+	std::vector<std::uint32_t> next;
+	std::vector<bool> accept_mid;
+	std::vector<bool> accept_end;
+	std::vector<bool> dead;
+	bool has_dfa = false;
+
+	std::size_t add(state::kind_t kind, std::size_t out, std::size_t out1 = 0, std::size_t set = 0)
+	{
+		if (nfa.size() >= max_nfa_states)
+			throw unsupported();
+
+		nfa.push_back({kind, set, out, out1});
+		return nfa.size() - 1;
+	}
+
+	// compiles n in a way that after matching it continues with follow
+	std::size_t emit(const node &n, std::size_t follow)
+	{
+		switch (n.kind) {
+		case node::chars:
+			sets.push_back(n.set);
+			return add(state::chars, follow, 0, sets.size() - 1);
+		case node::bol:
+			return add(state::bol, follow);
+		case node::eol:
+			return add(state::eol, follow);
+		case node::concat:
+			for (auto it = n.children.rbegin(); it != n.children.rend(); ++it)
+				follow = emit(*it, follow);
+			return follow;
+		case node::alternate: {
+			std::size_t s = emit(n.children.back(), follow);
+			for (auto it = n.children.rbegin() + 1; it != n.children.rend(); ++it)
+				s = add(state::split, emit(*it, follow), s);
+			return s;
+		}
+		case node::repeat: {
+			std::size_t s = follow;
+			if (n.max == unbounded) {
+				s = add(state::split, 0, follow);
+				nfa[s].out = emit(n.children.front(), s);
+			} else
+				for (std::size_t i = n.min; i < n.max; i++)
+					s = add(state::split, emit(n.children.front(), s), follow);
+
+			for (std::size_t i = 0; i < n.min; i++)
+				s = emit(n.children.front(), s);
+			return s;
+		}
+		}
+
+		return follow;
+	}
+
+	// epsilon-closure of kernel plus the start state (unanchored search restarts at every position),
+	// returns the character-consuming states and whether the match-state is reached
+	bool closure(const std::vector<std::size_t> &kernel, bool at_begin, bool at_end, std::vector<std::size_t> &result) const
+	{
+		std::vector<bool> visited(nfa.size(), false);
+		std::vector<std::size_t> stack(kernel.rbegin(), kernel.rend());
+		stack.push_back(start);
+		bool matched = false;
+
+		result.clear();
+
+		while (!stack.empty()) {
+			std::size_t s = stack.back();
+			stack.pop_back();
+
+			if (visited[s])
+				continue;
+			visited[s] = true;
+
+			const state &st = nfa[s];
+			switch (st.kind) {
+			case state::chars:
+				result.push_back(s);
+				break;
+			case state::split:
+				stack.push_back(st.out1);
+				stack.push_back(st.out);
+				break;
+			case state::bol:
+				if (at_begin)
+					stack.push_back(st.out);
+				break;
+			case state::eol:
+				if (at_end)
+					stack.push_back(st.out);
+				break;
+			case state::match:
+				matched = true;
+				break;
+			}
+		}
+
+		std::sort(result.begin(), result.end());
+
+		return matched;
+	}
+
+	void step(const std::vector<std::size_t> &current, unsigned char c, std::vector<std::size_t> &kernel) const
+	{
+		kernel.clear();
+		for (auto s : current)
+			if (sets[nfa[s].set][c])
+				kernel.push_back(nfa[s].out);
+
+		std::sort(kernel.begin(), kernel.end());
+		kernel.erase(std::unique(kernel.begin(), kernel.end()), kernel.end());
+	}
+
+	void build_byte_classes()
+	{
+		for (const auto &set : sets) {
+			std::map<std::pair<std::uint16_t, bool>, std::uint16_t> split;
+			for (std::size_t c = 0; c < 256; c++) {
+				auto key = std::make_pair(byte_class[c], static_cast<bool>(set[c]));
+				auto it = split.find(key);
+				if (it == split.end())
+					it = split.insert({key, static_cast<std::uint16_t>(split.size())}).first;
+				byte_class[c] = it->second;
+			}
+		}
+
+		classes = *std::max_element(byte_class.begin(), byte_class.end()) + 1u;
+	}
+
+	void build_dfa()
+	{
+		build_byte_classes();
+
+		std::vector<unsigned char> representative(classes);
+		for (std::size_t c = 256; c-- > 0;)
+			representative[byte_class[c]] = static_cast<unsigned char>(c);
+
+		// a DFA-state is the kernel reached after consuming a byte, the initial state is the only one at the beginning
+		std::map<std::pair<bool, std::vector<std::size_t>>, std::uint32_t> ids;
+		std::vector<std::pair<bool, std::vector<std::size_t>>> states;
+
+		states.push_back({true, {}});
+		ids[states.front()] = 0;
+
+		std::vector<std::size_t> current;
+		std::vector<std::size_t> kernel;
+
+		for (std::size_t i = 0; i < states.size(); i++) {
+			if (states.size() > max_dfa_states) {
+				next.clear();
+				return; // NFA-simulation it is
+			}
+
+			const bool at_begin = states[i].first;
+			const std::vector<std::size_t> from = states[i].second;
+
+			accept_end.push_back(closure(from, at_begin, true, current));
+			accept_mid.push_back(closure(from, at_begin, false, current));
+
+			for (std::size_t c = 0; c < classes; c++) {
+				step(current, representative[c], kernel);
+
+				auto key = std::make_pair(false, kernel);
+				auto it = ids.find(key);
+				if (it == ids.end()) {
+					it = ids.insert({key, static_cast<std::uint32_t>(states.size())}).first;
+					states.push_back(std::move(key));
+				}
+				next.push_back(it->second);
+			}
+		}
+
+		// a state is dead if no accepting state can be reached from it anymore
+		std::vector<bool> live(states.size());
+		for (std::size_t s = 0; s < states.size(); s++)
+			live[s] = accept_mid[s] || accept_end[s];
+
+		for (bool changed = true; changed;) {
+			changed = false;
+			for (std::size_t s = 0; s < states.size(); s++)
+				for (std::size_t c = 0; !live[s] && c < classes; c++)
+					if (live[next[s * classes + c]])
+						live[s] = changed = true;
+		}
+
+		dead.resize(states.size());
+		for (std::size_t s = 0; s < states.size(); s++)
+			dead[s] = !live[s];
+
+		has_dfa = true;
+	}
+
+	explicit program(const node &root)
+	{
+		std::size_t match_state = add(state::match, 0);
+		start = emit(root, match_state);
+
+		build_dfa();
+	}
+
+	bool search(const std::string &subject) const
+	{
+		if (has_dfa) {
+			std::size_t s = 0;
+
+			for (char c : subject) {
+				if (accept_mid[s])
+					return true;
+				if (dead[s])
+					return false;
+				s = next[s * classes + byte_class[static_cast<unsigned char>(c)]];
+			}
+
+			return accept_end[s];
+		}
+
+		std::vector<std::size_t> current;
+		std::vector<std::size_t> kernel;
+
+		for (std::size_t i = 0; i < subject.size(); i++) {
+			if (closure(kernel, i == 0, false, current))
+				return true;
+			step(current, static_cast<unsigned char>(subject[i]), kernel);
+		}
+
+		return closure(kernel, subject.empty(), true, current);
+	}
+};
+
+struct json_pattern::fallback {
+#ifndef NO_STD_REGEX
+	REGEX_NAMESPACE::regex regex;
+
+	explicit fallback(const std::string &pattern)
+	    : regex(pattern, REGEX_NAMESPACE::regex::ECMAScript) {}
+
+	bool search(const std::string &subject) const { return REGEX_NAMESPACE::regex_search(subject, regex); }
+#else
+	explicit fallback(const std::string &pattern)
+	{
+		throw std::invalid_argument("pattern '" + pattern + "' needs a regex-engine, but none is available");
+	}
+
+	bool search(const std::string &) const { return false; }
+#endif
+};
+
+json_pattern::json_pattern(const std::string &pattern)
+{
+	try {
+		program_ = std::make_shared<const program>(parser(pattern).parse());
+	} catch (const unsupported &) {
+		fallback_ = std::make_shared<const fallback>(pattern);
+	}
+}
+
+bool json_pattern::search(const std::string &subject) const
+{
+	if (program_)
+		return program_->search(subject);
+
+	return fallback_->search(subject);
+}
+
+} // namespace nlohmann
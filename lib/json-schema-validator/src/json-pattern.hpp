@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+namespace nlohmann
+{
+
+// Matcher for the ECMAScript regular expressions used by "pattern" and
+// "patternProperties".
+//
+// The common subset (literals, ".", character classes, \d \w \s and their
+// negations, groups, alternation, greedy and lazy quantifiers, ^ and $) is
+// compiled into a DFA which searches in linear time without recursion. All
+// other constructs (back-references, look-arounds, word-boundaries, ...) are
+// delegated to the regex-engine selected at build time. Matching is done
+// byte-wise, as std::regex does for std::string.
+class json_pattern
+{
+public:
+	// throws the same exception as the fallback regex-engine for invalid patterns
+	explicit json_pattern(const std::string &pattern);
+
+	// true if any substring of subject matches - same as regex_search()
+	bool search(const std::string &subject) const;
+
+	// true if the pattern has been compiled into a DFA (or the NFA fallback
+	// for very large automatons) instead of being delegated to the regex-engine
+	bool is_compiled() const { return program_ != nullptr; }
+
+private:
+	struct program;
+	struct fallback;
+
+	std::shared_ptr<const program> program_;
+	std::shared_ptr<const fallback> fallback_;
+};
+
+} // namespace nlohmann
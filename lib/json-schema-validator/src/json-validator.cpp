@@ -9,6 +9,7 @@
 #include <nlohmann/json-schema.hpp>
 
 #include "json-patch.hpp"
+#include "json-pattern.hpp"
 
 #include <deque>
 #include <memory>
@@ -18,18 +19,13 @@
 
 using nlohmann::json;
 using nlohmann::json_patch;
+using nlohmann::json_pattern;
 using nlohmann::json_uri;
 using nlohmann::json_schema::root_schema;
 using namespace nlohmann::json_schema;
 
-#ifdef JSON_SCHEMA_BOOST_REGEX
-#	include <boost/regex.hpp>
-#	define REGEX_NAMESPACE boost
-#elif defined(JSON_SCHEMA_NO_REGEX)
+#ifdef JSON_SCHEMA_NO_REGEX
 #	define NO_STD_REGEX
-#else
-#	include <regex>
-#	define REGEX_NAMESPACE std
 #endif
 
 namespace
@@ -702,7 +698,7 @@ class string : public schema
 	std::pair<bool, size_t> minLength_{false, 0};
 
 #ifndef NO_STD_REGEX
-	std::pair<bool, REGEX_NAMESPACE::regex> pattern_{false, REGEX_NAMESPACE::regex()};
+	std::pair<bool, json_pattern> pattern_{false, json_pattern("")};
 	std::string patternString_;
 #endif
 
@@ -756,7 +752,7 @@ class string : public schema
 
 #ifndef NO_STD_REGEX
 		if (pattern_.first &&
-		    !REGEX_NAMESPACE::regex_search(instance.get<std::string>(), pattern_.second))
+		    !pattern_.second.search(instance.get<std::string>()))
 			e.error(ptr, instance, "instance does not match regex pattern: " + patternString_);
 #endif
 
@@ -824,8 +820,7 @@ public:
 		attr = sch.find("pattern");
 		if (attr != sch.end()) {
 			patternString_ = attr.value().get<std::string>();
-			pattern_ = {true, REGEX_NAMESPACE::regex(attr.value().get<std::string>(),
-			                                         REGEX_NAMESPACE::regex::ECMAScript)};
+			pattern_ = {true, json_pattern(patternString_)};
 			sch.erase(attr);
 		}
 #endif
@@ -990,7 +985,7 @@ class object : public schema
 
 	std::map<std::string, std::shared_ptr<schema>> properties_;
 #ifndef NO_STD_REGEX
-	std::vector<std::pair<REGEX_NAMESPACE::regex, std::shared_ptr<schema>>> patternProperties_;
+	std::vector<std::pair<json_pattern, std::shared_ptr<schema>>> patternProperties_;
 #endif
 	std::shared_ptr<schema> additionalProperties_;
 
@@ -1026,7 +1021,7 @@ class object : public schema
 #ifndef NO_STD_REGEX
 			// check all matching patternProperties
 			for (auto &schema_pp : patternProperties_)
-				if (REGEX_NAMESPACE::regex_search(p.key(), schema_pp.first)) {
+				if (schema_pp.first.search(p.key())) {
 					a_prop_or_pattern_matched = true;
 					schema_pp.second->validate(ptr / p.key(), p.value(), patch, e);
 				}
@@ -1099,7 +1094,7 @@ public:
 			for (auto prop : attr.value().items())
 				patternProperties_.push_back(
 				    std::make_pair(
-				        REGEX_NAMESPACE::regex(prop.key(), REGEX_NAMESPACE::regex::ECMAScript),
+				        json_pattern(prop.key()),
 				        schema::make(prop.value(), root, {prop.key()}, uris)));
 			sch.erase(attr);
 		}
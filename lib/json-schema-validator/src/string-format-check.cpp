@@ -1,6 +1,7 @@
 #include <nlohmann/json-schema.hpp>
 
 #include <algorithm>
+#include <cstring>
 #include <exception>
 #include <iostream>
 #include <regex>
@@ -10,11 +11,63 @@
 #include <vector>
 
 /**
- * Many of the RegExes are from @see http://jmrware.com/articles/2009/uri_regexp/URI_regex.html
+ * The recognizers follow the ABNF of the linked RFCs, they have been derived from the RegExes
+ * @see http://jmrware.com/articles/2009/uri_regexp/URI_regex.html
+ * which have been used before and accept exactly the same strings.
  */
 
 namespace
 {
+using iterator = const char *;
+
+iterator begin_of(const std::string &value)
+{
+	return value.data();
+}
+
+iterator end_of(const std::string &value)
+{
+	return value.data() + value.size();
+}
+
+bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+bool is_alpha(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+bool is_alnum(char c)
+{
+	return is_digit(c) || is_alpha(c);
+}
+
+bool is_hexdig(char c)
+{
+	return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+bool is_one_of(char c, const char *chars)
+{
+	return c != '\0' && std::strchr(chars, c) != nullptr;
+}
+
+bool is_digits(iterator first, iterator last)
+{
+	return std::all_of(first, last, is_digit);
+}
+
+int to_int(iterator first, iterator last)
+{
+	int value = 0;
+	for (; first != last; ++first)
+		value = value * 10 + (*first - '0');
+	return value;
+}
+
 template <typename T>
 void range_check(const T value, const T min, const T max)
 {
@@ -25,19 +78,52 @@ void range_check(const T value, const T min, const T max)
 	}
 }
 
+/** full-date = 4DIGIT "-" 2DIGIT "-" 2DIGIT */
+bool is_rfc3339_date(iterator first, iterator last)
+{
+	return last - first == 10 && is_digits(first, first + 4) && first[4] == '-' && is_digits(first + 5, first + 7) &&
+	       first[7] == '-' && is_digits(first + 8, first + 10);
+}
+
+/** partial-time = 2DIGIT ":" 2DIGIT ":" 2DIGIT ["." 1*DIGIT], @return the end of it or nullptr */
+iterator rfc3339_partial_time(iterator first, iterator last)
+{
+	if (last - first < 8 || !is_digits(first, first + 2) || first[2] != ':' || !is_digits(first + 3, first + 5) ||
+	    first[5] != ':' || !is_digits(first + 6, first + 8))
+		return nullptr;
+
+	iterator p = first + 8;
+	if (p != last && *p == '.') {
+		iterator secfrac = ++p;
+		while (p != last && is_digit(*p))
+			++p;
+		if (p == secfrac)
+			return nullptr;
+	}
+
+	return p;
+}
+
+/** time-offset = "Z" / ("+" / "-") 2DIGIT ":" 2DIGIT */
+bool is_rfc3339_time_offset(iterator first, iterator last)
+{
+	if (last - first == 1)
+		return *first == 'Z' || *first == 'z';
+
+	return last - first == 6 && (*first == '+' || *first == '-') && is_digits(first + 1, first + 3) && first[3] == ':' &&
+	       is_digits(first + 4, first + 6);
+}
+
 /** @see date_time_check */
 void rfc3339_date_check(const std::string &value)
 {
-	const static std::regex dateRegex{R"(^([0-9]{4})\-([0-9]{2})\-([0-9]{2})$)"};
-
-	std::smatch matches;
-	if (!std::regex_match(value, matches, dateRegex)) {
+	if (!is_rfc3339_date(begin_of(value), end_of(value))) {
 		throw std::invalid_argument(value + " is not a date string according to RFC 3339.");
 	}
 
-	const auto year = std::stoi(matches[1].str());
-	const auto month = std::stoi(matches[2].str());
-	const auto mday = std::stoi(matches[3].str());
+	const auto year = to_int(begin_of(value), begin_of(value) + 4);
+	const auto month = to_int(begin_of(value) + 5, begin_of(value) + 7);
+	const auto mday = to_int(begin_of(value) + 8, begin_of(value) + 10);
 
 	const auto isLeapYear = (year % 4 == 0) && ((year % 100 != 0) || (year % 400 == 0));
 
@@ -54,17 +140,16 @@ void rfc3339_date_check(const std::string &value)
 /** @see date_time_check */
 void rfc3339_time_check(const std::string &value)
 {
-	const static std::regex timeRegex{R"(^([0-9]{2})\:([0-9]{2})\:([0-9]{2})(\.[0-9]+)?(?:[Zz]|((?:\+|\-)[0-9]{2})\:([0-9]{2}))$)"};
+	const iterator first = begin_of(value);
+	const iterator offset = rfc3339_partial_time(first, end_of(value));
 
-	std::smatch matches;
-	if (!std::regex_match(value, matches, timeRegex)) {
+	if (offset == nullptr || !is_rfc3339_time_offset(offset, end_of(value))) {
 		throw std::invalid_argument(value + " is not a time string according to RFC 3339.");
 	}
 
-	auto hour = std::stoi(matches[1].str());
-	auto minute = std::stoi(matches[2].str());
-	auto second = std::stoi(matches[3].str());
-	// const auto secfrac      = std::stof( matches[4].str() );
+	auto hour = to_int(first, first + 2);
+	auto minute = to_int(first + 3, first + 5);
+	auto second = to_int(first + 6, first + 8);
 
 	range_check(hour, 0, 23);
 	range_check(minute, 0, 59);
@@ -73,9 +158,11 @@ void rfc3339_time_check(const std::string &value)
 	    offsetMinute = 0;
 
 	/* don't check the numerical offset if time zone is specified as 'Z' */
-	if (!matches[5].str().empty()) {
-		offsetHour = std::stoi(matches[5].str());
-		offsetMinute = std::stoi(matches[6].str());
+	if (end_of(value) - offset == 6) {
+		offsetHour = to_int(offset + 1, offset + 3);
+		if (*offset == '-')
+			offsetHour *= -1;
+		offsetMinute = to_int(offset + 4, offset + 6);
 
 		range_check(offsetHour, -23, 23);
 		range_check(offsetMinute, 0, 59);
@@ -129,56 +216,150 @@ void rfc3339_time_check(const std::string &value)
  */
 void rfc3339_date_time_check(const std::string &value)
 {
-	const static std::regex dateTimeRegex{R"(^([0-9]{4}\-[0-9]{2}\-[0-9]{2})[Tt]([0-9]{2}\:[0-9]{2}\:[0-9]{2}(?:\.[0-9]+)?(?:[Zz]|(?:\+|\-)[0-9]{2}\:[0-9]{2}))$)"};
+	const iterator first = begin_of(value);
+	const iterator offset = value.size() > 11 ? rfc3339_partial_time(first + 11, end_of(value)) : nullptr;
 
-	std::smatch matches;
-	if (!std::regex_match(value, matches, dateTimeRegex)) {
+	if (offset == nullptr || !is_rfc3339_time_offset(offset, end_of(value)) || !is_rfc3339_date(first, first + 10) ||
+	    (first[10] != 'T' && first[10] != 't')) {
 		throw std::invalid_argument(value + " is not a date-time string according to RFC 3339.");
 	}
 
-	rfc3339_date_check(matches[1].str());
-	rfc3339_time_check(matches[2].str());
-}
-
-const std::string decOctet{R"((?:25[0-5]|2[0-4][0-9]|1[0-9][0-9]|[1-9]?[0-9]))"}; // matches numbers 0-255
-const std::string ipv4Address{"(?:" + decOctet + R"(\.){3})" + decOctet};
-const std::string h16{R"([0-9A-Fa-f]{1,4})"};
-const std::string h16Left{"(?:" + h16 + ":)"};
-const std::string ipv6Address{
-    "(?:"
-    "(?:" +
-    h16Left + "{6}"
-              "|::" +
-    h16Left + "{5}"
-              "|(?:" +
-    h16 + ")?::" + h16Left + "{4}"
-                             "|(?:" +
-    h16Left + "{0,1}" + h16 + ")?::" + h16Left + "{3}"
-                                                 "|(?:" +
-    h16Left + "{0,2}" + h16 + ")?::" + h16Left + "{2}"
-                                                 "|(?:" +
-    h16Left + "{0,3}" + h16 + ")?::" + h16Left +
-    "|(?:" + h16Left + "{0,4}" + h16 + ")?::"
-                                       ")(?:" +
-    h16Left + h16 + "|" + ipv4Address + ")"
-                                        "|(?:" +
-    h16Left + "{0,5}" + h16 + ")?::" + h16 +
-    "|(?:" + h16Left + "{0,6}" + h16 + ")?::"
-                                       ")"};
-const std::string ipvFuture{R"([Vv][0-9A-Fa-f]+\.[A-Za-z0-9\-._~!$&'()*+,;=:]+)"};
-const std::string regName{R"((?:[A-Za-z0-9\-._~!$&'()*+,;=]|%[0-9A-Fa-f]{2})*)"};
-const std::string host{
-    "(?:"
-    R"(\[(?:)" +
-    ipv6Address + "|" + ipvFuture + R"()\])" +
-    "|" + ipv4Address +
-    "|" + regName +
-    ")"};
-
-const std::string uuid{R"([0-9a-fA-F]{8}\-[0-9a-fA-F]{4}\-[0-9a-fA-F]{4}\-[0-9a-fA-F]{4}\-[0-9a-fA-F]{12})"};
+	rfc3339_date_check(value.substr(0, 10));
+	rfc3339_time_check(value.substr(11));
+}
+
+/**
+ * dec-octet = 0-255 without leading zeros, or with leading zeros (up to three digits) if not strict
+ */
+bool is_dec_octet(iterator first, iterator last, bool strict)
+{
+	if (last - first < 1 || last - first > 3 || !is_digits(first, last))
+		return false;
+
+	if (strict && last - first > 1 && *first == '0')
+		return false;
+
+	return to_int(first, last) <= 255;
+}
+
+/** IPv4address = dec-octet "." dec-octet "." dec-octet "." dec-octet */
+bool is_ipv4_address(iterator first, iterator last, bool strict)
+{
+	for (int i = 0; i < 3; i++) {
+		iterator dot = std::find(first, last, '.');
+		if (dot == last || !is_dec_octet(first, dot, strict))
+			return false;
+		first = dot + 1;
+	}
+
+	return is_dec_octet(first, last, strict);
+}
+
+/** h16 = 1*4HEXDIG */
+bool is_h16(iterator first, iterator last)
+{
+	return last - first >= 1 && last - first <= 4 && std::all_of(first, last, is_hexdig);
+}
+
+/**
+ * Counts the pieces of a ":"-separated list of h16 where the last one may be an IPv4address
+ * (counting as two pieces, like ls32) if allowed.
+ */
+bool ipv6_pieces(iterator first, iterator last, bool ipv4, bool strict, std::size_t &pieces)
+{
+	pieces = 0;
+
+	if (first == last)
+		return true;
+
+	for (;;) {
+		iterator colon = std::find(first, last, ':');
+
+		if (colon == last && ipv4 && std::find(first, last, '.') != last) {
+			pieces += 2;
+			return is_ipv4_address(first, last, strict);
+		}
+
+		if (!is_h16(first, colon))
+			return false;
+
+		pieces++;
+
+		if (colon == last)
+			return true;
+
+		first = colon + 1;
+	}
+}
+
+/**
+ * IPv6address = 8 pieces, or at most 7 pieces with one "::" in between - ls32 is only allowed at the end
+ *
+ * @see rfc3986_uri_check for the full ABNF
+ */
+bool is_ipv6_address(iterator first, iterator last, bool strict)
+{
+	const char doubleColon[] = "::";
+	iterator gap = std::search(first, last, doubleColon, doubleColon + 2);
+
+	std::size_t left = 0;
+	std::size_t right = 0;
+
+	if (gap == last)
+		return ipv6_pieces(first, last, true, strict, left) && left == 8;
+
+	return ipv6_pieces(first, gap, false, strict, left) && ipv6_pieces(gap + 2, last, true, strict, right) &&
+	       left + right <= 7;
+}
+
+/** alphanumeric label with inner "-", at most maxLength characters */
+bool is_label(iterator first, iterator last, std::ptrdiff_t maxLength)
+{
+	return last - first >= 1 && last - first <= maxLength && is_alnum(*first) && is_alnum(last[-1]) &&
+	       std::all_of(first, last, [](char c) { return is_alnum(c) || c == '-'; });
+}
+
+/** @return true if value consists of at least minLabels labels separated by "." */
+bool is_labels(iterator first, iterator last, std::ptrdiff_t maxLength, std::size_t minLabels)
+{
+	std::size_t labels = 0;
+
+	for (;;) {
+		iterator dot = std::find(first, last, '.');
+		if (!is_label(first, dot, maxLength))
+			return false;
+
+		labels++;
+
+		if (dot == last)
+			return labels >= minLabels;
+
+		first = dot + 1;
+	}
+}
 
 // from http://stackoverflow.com/questions/106179/regular-expression-to-match-dns-hostname-or-ip-address
-const std::string hostname{R"(^([a-zA-Z0-9]|[a-zA-Z0-9][a-zA-Z0-9\-]{0,61}[a-zA-Z0-9])(\.([a-zA-Z0-9]|[a-zA-Z0-9][a-zA-Z0-9\-]{0,61}[a-zA-Z0-9]))*$)"};
+bool is_hostname(iterator first, iterator last)
+{
+	return is_labels(first, last, 63, 1);
+}
+
+/** 8HEXDIG "-" 4HEXDIG "-" 4HEXDIG "-" 4HEXDIG "-" 12HEXDIG */
+bool is_uuid(iterator first, iterator last)
+{
+	if (last - first != 36)
+		return false;
+
+	for (std::ptrdiff_t i = 0; i < 36; i++) {
+		if (i == 8 || i == 13 || i == 18 || i == 23) {
+			if (first[i] != '-')
+				return false;
+		} else if (!is_hexdig(first[i]))
+			return false;
+	}
+
+	return true;
+}
 
 /**
  * @see https://tools.ietf.org/html/rfc5322#section-4.1
@@ -243,28 +424,191 @@ const std::string hostname{R"(^([a-zA-Z0-9]|[a-zA-Z0-9][a-zA-Z0-9\-]{0,61}[a-zA-
  *                     %d94-126 /         ;  characters not including
  *                     obs-dtext          ;  "[", "]", or "\"
  * @endverbatim
- * @todo Currently don't have a working tool for this larger ABNF to generate a regex.
- *       Other options:
- *         - https://github.com/ldthomas/apg-6.3
- *         - https://github.com/akr/abnf
- *
- * The problematic thing are the allowed whitespaces (even newlines) in the email.
- * Ignoring those and starting with
+ * Whitespaces (even newlines) and comments are not supported. Following
  * @see https://stackoverflow.com/questions/13992403/regex-validation-of-email-addresses-according-to-rfc5321-rfc5322
- * and trying to divide up the complicated regex into understandable ABNF definitions from rfc5322 yields:
+ * the local-part is a dot-atom or a quoted-string (including obs-qtext and obs-qp) and the domain is
+ * either a sequence of at least two alphanumeric labels or a domain-literal.
  */
-const std::string obsnowsctl{R"([\x01-\x08\x0b\x0c\x0e-\x1f\x7f])"};
-const std::string obsqp{R"(\\[\x01-\x09\x0b\x0c\x0e-\x7f])"};
-const std::string qtext{R"((?:[\x21\x23-\x5b\x5d-\x7e]|)" + obsnowsctl + ")"};
-const std::string dtext{R"([\x01-\x08\x0b\x0c\x0e-\x1f\x21-\x5a\x53-\x7f])"};
-const std::string quotedString{R"("(?:)" + qtext + "|" + obsqp + R"()*")"};
-const std::string atext{R"([A-Za-z0-9!#$%&'*+/=?^_`{|}~-])"};
-const std::string domainLiteral{R"(\[(?:(?:)" + decOctet + R"()\.){3}(?:)" + decOctet + R"(|[A-Za-z0-9-]*[A-Za-z0-9]:(?:)" + dtext + "|" + obsqp + R"()+)\])"};
-
-const std::string dotAtom{"(?:" + atext + R"(+(?:\.)" + atext + "+)*)"};
-const std::string stackoverflowMagicPart{R"((?:[[:alnum:]](?:[[:alnum:]-]*[[:alnum:]])?\.)+)"
-                                         R"([[:alnum:]](?:[[:alnum:]-]*[[:alnum:]])?)"};
-const std::string email{"(?:" + dotAtom + "|" + quotedString + ")@(?:" + stackoverflowMagicPart + "|" + domainLiteral + ")"};
+bool is_atext(char c)
+{
+	return is_alnum(c) || is_one_of(c, "!#$%&'*+/=?^_`{|}~-");
+}
+
+bool is_obs_no_ws_ctl(unsigned char c)
+{
+	return (c >= 0x01 && c <= 0x08) || c == 0x0b || c == 0x0c || (c >= 0x0e && c <= 0x1f) || c == 0x7f;
+}
+
+bool is_qtext(unsigned char c)
+{
+	return c == 0x21 || (c >= 0x23 && c <= 0x5b) || (c >= 0x5d && c <= 0x7e) || is_obs_no_ws_ctl(c);
+}
+
+/** the character following the "\" of a quoted-pair */
+bool is_obs_qp(unsigned char c)
+{
+	return c >= 0x01 && c <= 0x7f && c != 0x0a && c != 0x0d;
+}
+
+bool is_dtext(unsigned char c)
+{
+	return (c >= 0x21 && c <= 0x7f) || (is_obs_no_ws_ctl(c) && c != 0x7f);
+}
+
+/** dot-atom-text = 1*atext *("." 1*atext) */
+bool is_dot_atom(iterator first, iterator last)
+{
+	for (;;) {
+		iterator dot = std::find(first, last, '.');
+		if (dot == first || !std::all_of(first, dot, is_atext))
+			return false;
+
+		if (dot == last)
+			return true;
+
+		first = dot + 1;
+	}
+}
+
+/** DQUOTE *(qtext / quoted-pair) DQUOTE, @return the end of it or nullptr */
+iterator quoted_string(iterator first, iterator last)
+{
+	if (first == last || *first != '"')
+		return nullptr;
+
+	for (++first; first != last && *first != '"'; ++first) {
+		if (*first == '\\') {
+			if (++first == last || !is_obs_qp(*first))
+				return nullptr;
+		} else if (!is_qtext(*first))
+			return nullptr;
+	}
+
+	return first == last ? nullptr : first + 1;
+}
+
+/**
+ * "[" 3(dec-octet ".") (dec-octet / tag ":" 1*(dtext / quoted-pair)) "]"
+ * with tag = *(ALPHA / DIGIT / "-") (ALPHA / DIGIT)
+ */
+bool is_domain_literal(iterator first, iterator last)
+{
+	if (last - first < 2 || *first != '[' || last[-1] != ']')
+		return false;
+
+	++first;
+	--last;
+
+	for (int i = 0; i < 3; i++) {
+		iterator dot = std::find(first, last, '.');
+		if (dot == last || !is_dec_octet(first, dot, true))
+			return false;
+		first = dot + 1;
+	}
+
+	if (is_dec_octet(first, last, true))
+		return true;
+
+	iterator colon = std::find(first, last, ':');
+	if (colon == first || colon == last || !is_alnum(colon[-1]) ||
+	    !std::all_of(first, colon, [](char c) { return is_alnum(c) || c == '-'; }))
+		return false;
+
+	first = colon + 1;
+	if (first == last)
+		return false;
+
+	// a white-space is only allowed as quoted-pair
+	for (iterator c = first; c != last; ++c)
+		if (!is_dtext(*c) && !((*c == ' ' || *c == '\t') && c != first && c[-1] == '\\'))
+			return false;
+
+	return true;
+}
+
+/** (dot-atom / quoted-string) "@" (1*(label ".") label / domain-literal) */
+bool is_email(iterator first, iterator last)
+{
+	iterator at = (first != last && *first == '"') ? quoted_string(first, last) : std::find(first, last, '@');
+
+	if (at == nullptr || at == last || *at != '@' || (*first != '"' && !is_dot_atom(first, at)))
+		return false;
+
+	++at;
+	if (at != last && *at == '[')
+		return is_domain_literal(at, last);
+
+	return is_labels(at, last, last - at, 2);
+}
+
+bool is_unreserved(char c)
+{
+	return is_alnum(c) || is_one_of(c, "-._~");
+}
+
+bool is_sub_delim(char c)
+{
+	return is_one_of(c, "!$&'()*+,;=");
+}
+
+/** *(unreserved / pct-encoded / sub-delims / extra) */
+bool is_uri_chars(iterator first, iterator last, const char *extra)
+{
+	while (first != last) {
+		if (*first == '%') {
+			if (last - first < 3 || !is_hexdig(first[1]) || !is_hexdig(first[2]))
+				return false;
+			first += 3;
+		} else if (is_unreserved(*first) || is_sub_delim(*first) || is_one_of(*first, extra))
+			++first;
+		else
+			return false;
+	}
+
+	return true;
+}
+
+/** IPvFuture = "v" 1*HEXDIG "." 1*(unreserved / sub-delims / ":") */
+bool is_ipv_future(iterator first, iterator last)
+{
+	if (first == last || (*first != 'v' && *first != 'V'))
+		return false;
+
+	iterator dot = std::find_if_not(first + 1, last, is_hexdig);
+	if (dot == first + 1 || dot == last || *dot != '.' || dot + 1 == last)
+		return false;
+
+	return std::all_of(dot + 1, last, [](char c) { return is_unreserved(c) || is_sub_delim(c) || c == ':'; });
+}
+
+/**
+ * authority = [userinfo "@"] host [":" port]
+ *
+ * IPv4address is a subset of reg-name, the IPv4address of an IP-literal may have leading zeros
+ */
+bool is_authority(iterator first, iterator last)
+{
+	iterator at = std::find(first, last, '@');
+	if (at != last) {
+		if (!is_uri_chars(first, at, ":"))
+			return false;
+		first = at + 1;
+	}
+
+	if (first != last && *first == '[') {
+		iterator close = std::find(first, last, ']');
+		if (close == last || !(is_ipv6_address(first + 1, close, false) || is_ipv_future(first + 1, close)))
+			return false;
+		first = close + 1;
+	} else {
+		iterator colon = std::find(first, last, ':');
+		if (!is_uri_chars(first, colon, ""))
+			return false;
+		first = colon;
+	}
+
+	return first == last || (*first == ':' && is_digits(first + 1, last));
+}
 
 /**
  * @see json schema
@@ -357,46 +701,32 @@ const std::string email{"(?:" + dotAtom + "|" + quotedString + ")@(?:" + stackov
  */
 void rfc3986_uri_check(const std::string &value)
 {
-	const static std::string scheme{R"(([A-Za-z][A-Za-z0-9+\-.]*):)"};
-	const static std::string hierPart{
-	    R"((?:(\/\/)(?:((?:[A-Za-z0-9\-._~!$&'()*+,;=:]|)"
-	    R"(%[0-9A-Fa-f]{2})*)@)?((?:\[(?:(?:(?:(?:[0-9A-Fa-f]{1,4}:){6}|)"
-	    R"(::(?:[0-9A-Fa-f]{1,4}:){5}|)"
-	    R"((?:[0-9A-Fa-f]{1,4})?::(?:[0-9A-Fa-f]{1,4}:){4}|)"
-	    R"((?:(?:[0-9A-Fa-f]{1,4}:){0,1}[0-9A-Fa-f]{1,4})?::(?:[0-9A-Fa-f]{1,4}:){3}|)"
-	    R"((?:(?:[0-9A-Fa-f]{1,4}:){0,2}[0-9A-Fa-f]{1,4})?::(?:[0-9A-Fa-f]{1,4}:){2}|)"
-	    R"((?:(?:[0-9A-Fa-f]{1,4}:){0,3}[0-9A-Fa-f]{1,4})?::[0-9A-Fa-f]{1,4}:|)"
-	    R"((?:(?:[0-9A-Fa-f]{1,4}:){0,4}[0-9A-Fa-f]{1,4})?::)(?:[0-9A-Fa-f]{1,4}:[0-9A-Fa-f]{1,4}|)"
-	    R"((?:(?:25[0-5]|2[0-4][0-9]|)"
-	    R"([01]?[0-9][0-9]?)\.){3}(?:25[0-5]|)"
-	    R"(2[0-4][0-9]|)"
-	    R"([01]?[0-9][0-9]?))|)"
-	    R"((?:(?:[0-9A-Fa-f]{1,4}:){0,5}[0-9A-Fa-f]{1,4})?::[0-9A-Fa-f]{1,4}|)"
-	    R"((?:(?:[0-9A-Fa-f]{1,4}:){0,6}[0-9A-Fa-f]{1,4})?::)|)"
-	    R"([Vv][0-9A-Fa-f]+\.[A-Za-z0-9\-._~!$&'()*+,;=:]+)\]|)"
-	    R"((?:(?:25[0-5]|)"
-	    R"(2[0-4][0-9]|)"
-	    R"([01]?[0-9][0-9]?)\.){3}(?:25[0-5]|)"
-	    R"(2[0-4][0-9]|)"
-	    R"([01]?[0-9][0-9]?)|)"
-	    R"((?:[A-Za-z0-9\-._~!$&'()*+,;=]|)"
-	    R"(%[0-9A-Fa-f]{2})*))(?::([0-9]*))?((?:\/(?:[A-Za-z0-9\-._~!$&'()*+,;=:@]|)"
-	    R"(%[0-9A-Fa-f]{2})*)*)|)"
-	    R"(\/((?:(?:[A-Za-z0-9\-._~!$&'()*+,;=:@]|)"
-	    R"(%[0-9A-Fa-f]{2})+(?:\/(?:[A-Za-z0-9\-._~!$&'()*+,;=:@]|)"
-	    R"(%[0-9A-Fa-f]{2})*)*)?)|)"
-	    R"(((?:[A-Za-z0-9\-._~!$&'()*+,;=:@]|)"
-	    R"(%[0-9A-Fa-f]{2})+(?:\/(?:[A-Za-z0-9\-._~!$&'()*+,;=:@]|)"
-	    R"(%[0-9A-Fa-f]{2})*)*)|))"};
-
-	const static std::string query{R"((?:\?((?:[A-Za-z0-9\-._~!$&'()*+,;=:@\/?]|%[0-9A-Fa-f]{2})*))?)"};
-	const static std::string fragment{
-	    R"((?:\#((?:[A-Za-z0-9\-._~!$&'()*+,;=:@\/?]|%[0-9A-Fa-f]{2})*))?)"};
-	const static std::string uriFormat{scheme + hierPart + query + fragment};
-
-	const static std::regex uriRegex{uriFormat};
-
-	if (!std::regex_match(value, uriRegex)) {
+	const iterator first = begin_of(value);
+	const iterator last = end_of(value);
+
+	// scheme and hier-part can not contain "?" and "#", query can not contain "#"
+	const iterator colon = std::find(first, last, ':');
+	const iterator hierEnd = std::find_if(colon, last, [](char c) { return c == '?' || c == '#'; });
+	const iterator fragment = std::find(hierEnd, last, '#');
+
+	bool valid = colon != last && colon != first && is_alpha(*first) &&
+	             std::all_of(first, colon, [](char c) { return is_alnum(c) || is_one_of(c, "+-."); });
+
+	iterator path = colon + 1;
+	if (valid && hierEnd - path >= 2 && path[0] == '/' && path[1] == '/') {
+		path = std::find(path + 2, hierEnd, '/');
+		valid = is_authority(colon + 3, path);
+	}
+
+	valid = valid && is_uri_chars(path, hierEnd, ":@/");
+
+	if (valid && hierEnd != fragment) // query
+		valid = is_uri_chars(hierEnd + 1, fragment, ":@/?");
+
+	if (valid && fragment != last)
+		valid = is_uri_chars(fragment + 1, last, ":@/?");
+
+	if (!valid) {
 		throw std::invalid_argument(value + " is not a URI string according to RFC 3986.");
 	}
 }
@@ -408,9 +738,9 @@ namespace nlohmann
 namespace json_schema
 {
 /**
- * Checks validity for built-ins by converting the definitions given as ABNF in the linked RFC from
+ * Checks validity for built-ins by following the definitions given as ABNF in the linked RFC from
  * @see https://json-schema.org/understanding-json-schema/reference/string.html#built-in-formats
- * into regular expressions using @see https://www.msweet.org/abnf/ and some manual editing.
+ * with hand-written recognizers, which run in linear time and without recursion.
  *
  * @see https://json-schema.org/latest/json-schema-validation.html
  */
@@ -425,28 +755,23 @@ void default_string_format_check(const std::string &format, const std::string &v
 	} else if (format == "uri") {
 		rfc3986_uri_check(value);
 	} else if (format == "email") {
-		static const std::regex emailRegex{email};
-		if (!std::regex_match(value, emailRegex)) {
+		if (!is_email(begin_of(value), end_of(value))) {
 			throw std::invalid_argument(value + " is not a valid email according to RFC 5322.");
 		}
 	} else if (format == "hostname") {
-		static const std::regex hostRegex{hostname};
-		if (!std::regex_match(value, hostRegex)) {
+		if (!is_hostname(begin_of(value), end_of(value))) {
 			throw std::invalid_argument(value + " is not a valid hostname according to RFC 3986 Appendix A.");
 		}
 	} else if (format == "ipv4") {
-		const static std::regex ipv4Regex{"^" + ipv4Address + "$"};
-		if (!std::regex_match(value, ipv4Regex)) {
+		if (!is_ipv4_address(begin_of(value), end_of(value), true)) {
 			throw std::invalid_argument(value + " is not an IPv4 string according to RFC 2673.");
 		}
 	} else if (format == "ipv6") {
-		static const std::regex ipv6Regex{ipv6Address};
-		if (!std::regex_match(value, ipv6Regex)) {
+		if (!is_ipv6_address(begin_of(value), end_of(value), true)) {
 			throw std::invalid_argument(value + " is not an IPv6 string according to RFC 5954.");
 		}
 	} else if (format == "uuid") {
-		static const std::regex uuidRegex{uuid};
-		if (!std::regex_match(value, uuidRegex)) {
+		if (!is_uuid(begin_of(value), end_of(value))) {
 			throw std::invalid_argument(value + " is not an uuid string according to RFC 4122.");
 		}
 	} else if (format == "regex") {
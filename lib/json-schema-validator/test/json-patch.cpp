@@ -2,6 +2,7 @@
 
 #include <iostream>
 
+using nlohmann::json;
 using nlohmann::json_patch;
 
 #define OK(code)                                                    \
@@ -44,5 +45,29 @@ int main(void)
 	// invalid json-pointer
 	KO(json_patch p1(R"([{"op":"add","path":"0/renderable/bg","value":"Black"}])"_json));
 
+	// in-place patching has to give the same result as json::patch()
+	const json doc = R"({"a":{"b":[1,2,3]},"c":"d"})"_json;
+	for (const auto &patch : {R"([{"op":"add","path":"/a/e","value":"f"}])"_json,
+	                          R"([{"op":"add","path":"/a/b/1","value":5}])"_json,
+	                          R"([{"op":"add","path":"/a/b/-","value":5}])"_json,
+	                          R"([{"op":"replace","path":"/c","value":{"x":1}}])"_json,
+	                          R"([{"op":"remove","path":"/a/b/0"},{"op":"remove","path":"/c"}])"_json,
+	                          R"([{"op":"test","path":"/c","value":"d"},{"op":"move","from":"/c","path":"/a/c"}])"_json,
+	                          R"([{"op":"copy","from":"/a/b","path":"/b"}])"_json}) {
+		json inplace = doc;
+		OK(json_patch(patch).patch_inplace(inplace));
+		if (inplace != doc.patch(patch)) {
+			std::cerr << "patch_inplace differs for " << patch << ": " << inplace << "\n";
+			return 1;
+		}
+	}
+
+	// missing parent, missing key, index out of range, failing test
+	json inplace = doc;
+	KO(json_patch(R"([{"op":"add","path":"/x/y","value":1}])"_json).patch_inplace(inplace));
+	KO(json_patch(R"([{"op":"remove","path":"/x"}])"_json).patch_inplace(inplace));
+	KO(json_patch(R"([{"op":"add","path":"/a/b/4","value":1}])"_json).patch_inplace(inplace));
+	KO(json_patch(R"([{"op":"test","path":"/c","value":"e"}])"_json).patch_inplace(inplace));
+
 	return 0;
 }
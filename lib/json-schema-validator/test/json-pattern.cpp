@@ -0,0 +1,50 @@
+#include "../src/json-pattern.hpp"
+
+#include <iostream>
+#include <regex>
+#include <string>
+#include <vector>
+
+using nlohmann::json_pattern;
+
+int main(void)
+{
+	const std::vector<std::string> patterns{
+	    "^snode\\.c/_cfg_/.+$", "a+b*", "^(?:ab|cd){2,3}$", "[^\\d\\s]x?", "^[a-z0-9._%+-]+@[a-z0-9.-]+\\.[a-z]{2,}$",
+	    "\\w\\W\\s\\S\\d\\D", "^$", "", "[ab]*a[ab]{12}$",
+	    // delegated to the regex-engine
+	    "(a)\\1", "\\bfoo\\b", "a(?=b)"};
+	const std::vector<std::string> subjects{
+	    "", "a", "ab", "abcdab", "cdabcd", "snode.c/_cfg_/mapping", "snode.c/_cfg_/", "x", "1x", "a b1 ",
+	    "user@example.com", "foo bar", "aa", "aaaaaaaaaaaaaaaaaa", "bbbbbbbbbbbbabbbbbbbbbbb", "\n", "\xc3\xa4"};
+
+	int errors = 0;
+
+	for (const auto &pattern : patterns) {
+		const json_pattern compiled(pattern);
+		const std::regex regex(pattern, std::regex::ECMAScript);
+
+		for (const auto &subject : subjects)
+			if (compiled.search(subject) != std::regex_search(subject, regex)) {
+				std::cerr << "pattern '" << pattern << "' differs from std::regex for '" << subject << "'\n";
+				errors++;
+			}
+	}
+
+	if (!json_pattern("^(?:[a-z]|\\d)+$").is_compiled() || json_pattern("(a)\\1").is_compiled()) {
+		std::cerr << "unexpected choice of the matching engine\n";
+		errors++;
+	}
+
+	for (const auto &pattern : {"(a", "[\\d-z]"}) {
+		try {
+			json_pattern invalid(pattern);
+			std::cerr << "UNEXPECTED SUCCESS for '" << pattern << "'.\n";
+			errors++;
+		} catch (const std::exception &e) {
+			std::cerr << "EXPECTED FAIL: " << e.what() << "\n";
+		}
+	}
+
+	return errors != 0;
+}
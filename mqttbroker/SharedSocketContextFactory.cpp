@@ -33,17 +33,16 @@ namespace mqtt::mqttbroker {
         char* mappingFile = getenv("MQTT_MAPPING_FILE");
 
         if (mappingFile != nullptr) {
-            nlohmann::json mappingJson = mqtt::lib::JsonMappingReader::readMappingFromFile(mappingFile);
-
-            if (!mappingJson.empty()) {
-                jsonMapping = mappingJson["mapping"];
-            }
+            mqtt::lib::JsonMappingReader::readMappingFromFile(mappingFile);
         }
     }
 
     core::socket::SocketContext* SharedSocketContextFactory::create(core::socket::SocketConnection* socketConnection,
                                                                     std::shared_ptr<iot::mqtt::server::broker::Broker>& broker) {
-        return new iot::mqtt::SocketContext(socketConnection, new mqtt::mqttbroker::lib::Mqtt(broker, jsonMapping));
+        return new iot::mqtt::SocketContext(socketConnection,
+                                            new mqtt::mqttbroker::lib::Mqtt(broker,
+                                                                            mqtt::lib::JsonMappingReader::getMappingJson(),
+                                                                            mqtt::lib::JsonMappingReader::getMappedPublishCounters()));
     }
 
 } // namespace mqtt::mqttbroker
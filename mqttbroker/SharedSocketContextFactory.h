@@ -33,8 +33,6 @@ namespace iot::mqtt::server::broker {
 //
 
 #include <memory>
-#include <nlohmann/json.hpp>
-// IWYU pragma: no_include <nlohmann/json_fwd.hpp>
 
 namespace mqtt::mqttbroker {
 
@@ -44,9 +42,6 @@ namespace mqtt::mqttbroker {
 
         core::socket::SocketContext* create(core::socket::SocketConnection* socketConnection,
                                             std::shared_ptr<iot::mqtt::server::broker::Broker>& broker) final;
-
-    private:
-        nlohmann::json jsonMapping;
     };
 
 } // namespace mqtt::mqttbroker
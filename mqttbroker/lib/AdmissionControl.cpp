@@ -0,0 +1,111 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AdmissionControl.h"
+
+//
+
+#include <algorithm>
+#include <cmath>
+
+namespace mqtt::mqttbroker::lib {
+
+    static constexpr std::size_t maxPersistentClients = 65536;
+
+    AdmissionControl& AdmissionControl::instance() {
+        static AdmissionControl admissionControl;
+
+        return admissionControl;
+    }
+
+    void AdmissionControl::configure(double rate, double burst, std::size_t maxPending) {
+        this->rate = std::max(rate, 0.);
+        this->burst = std::max(burst, 1.);
+        this->maxPending = maxPending;
+
+        buckets.clear();
+    }
+
+    AdmissionControl::Admission AdmissionControl::connected(const std::string& listener) {
+        const Admission admission = maxPending == 0 || pending < maxPending ? admit(listener) : Admission::Refused;
+
+        if (admission != Admission::Refused) {
+            ++pending;
+        }
+
+        return admission;
+    }
+
+    void AdmissionControl::released() {
+        if (pending > 0) {
+            --pending;
+        }
+    }
+
+    bool AdmissionControl::reserveGranted(const std::string& listener, const std::string& clientId, bool cleanSession) {
+        const bool granted = !cleanSession && persistentClients.contains(clientId);
+
+        if (!granted) {
+            const auto it = buckets.find(listener);
+
+            if (it != buckets.end()) {
+                it->second.tokens = std::min(burst, it->second.tokens + 1);
+            }
+        }
+
+        return granted;
+    }
+
+    void AdmissionControl::persistentSessionConnected(const std::string& clientId) {
+        if (persistentClients.insert(clientId).second) {
+            persistentClientsOrder.push_back(clientId);
+
+            if (persistentClientsOrder.size() > maxPersistentClients) {
+                persistentClients.erase(persistentClientsOrder.front());
+                persistentClientsOrder.pop_front();
+            }
+        }
+    }
+
+    AdmissionControl::Admission AdmissionControl::admit(const std::string& listener) {
+        Admission admission = Admission::Admitted;
+
+        if (rate > 0) {
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+            Bucket& bucket = buckets.try_emplace(listener, Bucket{burst, now}).first->second;
+
+            bucket.tokens = std::min(burst, bucket.tokens + rate * std::chrono::duration<double>(now - bucket.lastRefill).count());
+            bucket.lastRefill = now;
+
+            if (bucket.tokens < 1) {
+                admission = Admission::Refused;
+            } else {
+                admission = bucket.tokens >= 1 + std::floor(burst / 4) ? Admission::Admitted : Admission::Reserved;
+                bucket.tokens -= 1;
+            }
+        }
+
+        return admission;
+    }
+
+    std::size_t AdmissionControl::getPendingCount() const {
+        return pending;
+    }
+
+} // namespace mqtt::mqttbroker::lib
@@ -0,0 +1,89 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MQTTBROKER_LIB_ADMISSIONCONTROL_H
+#define MQTTBROKER_LIB_ADMISSIONCONTROL_H
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_set>
+
+namespace mqtt::mqttbroker::lib {
+
+    // Admission control against reconnect storms. Admission is decided as soon as a connection is established, before its CONNECT is
+    // processed. Every listener has a token bucket which is refilled with a fixed number of connections per second, a connection is
+    // refused while the bucket of its listener is empty. A quarter of each bucket is reserved for clients resuming a persistent session.
+    // As the client id and the clean session flag are not known before the CONNECT, a connection taking a token of the reserve is
+    // admitted provisionally and checked once its CONNECT has arrived. Independently, the number of connections which have not sent
+    // their CONNECT yet is bounded, connections beyond that bound are refused.
+    class AdmissionControl {
+    private:
+        AdmissionControl() = default;
+
+    public:
+        enum class Admission {
+            Admitted,
+            Reserved, // admitted provisionally from the reserve
+            Refused
+        };
+
+        static AdmissionControl& instance();
+
+        // A rate of 0 disables the token buckets, a maxPending of 0 the bound of pending connections
+        void configure(double rate, double burst, std::size_t maxPending);
+
+        // A connection has been established on listener. Unless it is refused it is pending until released().
+        Admission connected(const std::string& listener);
+        // A pending connection has sent its CONNECT or has been disconnected before
+        void released();
+
+        // The CONNECT of a connection admitted from the reserve of listener has arrived. Returns false, and gives the token back, unless
+        // the client resumes a persistent session it has connected with before.
+        bool reserveGranted(const std::string& listener, const std::string& clientId, bool cleanSession);
+
+        // clientId has connected with a persistent session, its next connections may be admitted from the reserve
+        void persistentSessionConnected(const std::string& clientId);
+
+        std::size_t getPendingCount() const;
+
+    private:
+        struct Bucket {
+            double tokens;
+            std::chrono::steady_clock::time_point lastRefill;
+        };
+
+        double rate = 0;
+        double burst = 1;
+        std::size_t maxPending = 0;
+        std::size_t pending = 0;
+
+        Admission admit(const std::string& listener);
+
+        std::map<std::string, Bucket> buckets;
+
+        // Bounded, the oldest clients are forgotten first
+        std::unordered_set<std::string> persistentClients;
+        std::deque<std::string> persistentClientsOrder;
+    };
+
+} // namespace mqtt::mqttbroker::lib
+
+#endif // MQTTBROKER_LIB_ADMISSIONCONTROL_H
@@ -0,0 +1,330 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MappingWorkerPool.h"
+
+#include "lib/LogMutex.h"
+#include "lib/MqttMapper.h"
+#include "lib/MqttMetrics.h"
+#include "mqttbroker/lib/RetainedStore.h"
+#include "mqttbroker/lib/SharedSubscriptions.h"
+#include "mqttbroker/lib/WorkerFanout.h"
+
+#include <core/DescriptorEventReceiver.h>
+#include <core/eventreceiver/ReadEventReceiver.h>
+#include <iot/mqtt/server/broker/Broker.h>
+#include <log/Logger.h>
+
+//
+
+#include <cerrno>
+#include <functional>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <sys/eventfd.h>
+#include <tuple>
+#include <unistd.h>
+#include <utility>
+
+namespace mqtt::mqttbroker::lib {
+
+    namespace {
+
+        // Collects the mapped messages instead of publishing them and maps them in turn, as Mqtt::publishMapping() does
+        class CollectingMapper : public mqtt::lib::MqttMapper {
+        public:
+            CollectingMapper(const std::shared_ptr<const nlohmann::json>& mappingJson,
+                             const std::shared_ptr<const mqtt::lib::MqttMetrics::MappedPublishCounters>& mappedPublishCounters)
+                : mqtt::lib::MqttMapper(mappingJson, mappedPublishCounters) {
+                offEventLoop = true;
+            }
+
+            using mqtt::lib::MqttMapper::publishMappings;
+
+            std::vector<std::tuple<std::string, mqtt::lib::Payload, uint8_t, bool>> mappedPublishes;
+
+        private:
+            void publishMapping(const std::string& topic, const mqtt::lib::Payload& message, uint8_t qoS, bool retain) final {
+                mappedPublishes.emplace_back(topic, message, qoS, retain);
+
+                publishMappings(topic, message.str(), qoS);
+            }
+        };
+
+    } // namespace
+
+    // Drains the completed jobs as soon as a worker signals the eventfd
+    class MappingWorkerPool::EventReceiver : public core::eventreceiver::ReadEventReceiver {
+    public:
+        EventReceiver(MappingWorkerPool& mappingWorkerPool, int eventFd)
+            : core::eventreceiver::ReadEventReceiver("MappingWorkerPool", core::DescriptorEventReceiver::TIMEOUT::DISABLE)
+            , mappingWorkerPool(mappingWorkerPool) {
+            enable(eventFd);
+        }
+
+    private:
+        void readEvent() final {
+            mappingWorkerPool.drain();
+        }
+
+        void unobservedEvent() final {
+            if (mappingWorkerPool.eventReceiver == this) {
+                mappingWorkerPool.eventReceiver = nullptr;
+            }
+
+            delete this;
+        }
+
+        MappingWorkerPool& mappingWorkerPool;
+    };
+
+    MappingWorkerPool::~MappingWorkerPool() {
+        stop();
+    }
+
+    MappingWorkerPool& MappingWorkerPool::instance() {
+        static MappingWorkerPool mappingWorkerPool;
+
+        return mappingWorkerPool;
+    }
+
+    void MappingWorkerPool::setQueueLimits(std::size_t maxMessages, std::size_t maxBytes, OverflowPolicy overflowPolicy) {
+        maxQueuedMessages = maxMessages;
+        maxQueuedBytes = maxBytes;
+        this->overflowPolicy = overflowPolicy;
+    }
+
+    bool MappingWorkerPool::start(std::size_t workerCount) {
+        if (workers.empty() && workerCount > 0) {
+            eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+            if (eventFd >= 0) {
+                for (std::size_t i = 0; i < workerCount; ++i) {
+                    workers.push_back(std::make_unique<Worker>());
+                }
+                for (const std::unique_ptr<Worker>& worker : workers) {
+                    worker->thread = std::thread(&MappingWorkerPool::work, this, std::ref(*worker));
+                }
+
+                eventReceiver = new EventReceiver(*this, eventFd);
+
+                VLOG(0) << "Mapping offloaded to " << workerCount << " worker threads";
+            } else {
+                PLOG(ERROR) << "eventfd";
+            }
+        }
+
+        return !workers.empty();
+    }
+
+    void MappingWorkerPool::stop() {
+        if (eventReceiver != nullptr) {
+            eventReceiver->disable();
+            eventReceiver = nullptr;
+        }
+
+        for (const std::unique_ptr<Worker>& worker : workers) {
+            {
+                const std::scoped_lock<std::mutex> lock(worker->mutex);
+                worker->stopped = true;
+            }
+            worker->condition.notify_one();
+        }
+
+        for (const std::unique_ptr<Worker>& worker : workers) {
+            worker->thread.join();
+        }
+        workers.clear();
+
+        while (tail->next.load(std::memory_order_acquire) != nullptr) {
+            Completion* completion = tail->next.load(std::memory_order_acquire);
+            if (tail != &stub) {
+                delete tail;
+            }
+            tail = completion;
+        }
+        if (tail != &stub) {
+            delete tail;
+            tail = &stub;
+            stub.next.store(nullptr, std::memory_order_relaxed);
+            head.store(&stub, std::memory_order_relaxed);
+        }
+
+        if (eventFd >= 0) {
+            close(eventFd);
+            eventFd = -1;
+        }
+    }
+
+    bool MappingWorkerPool::isRunning() const {
+        return !workers.empty();
+    }
+
+    void MappingWorkerPool::submit(const std::shared_ptr<iot::mqtt::server::broker::Broker>& broker,
+                                   const std::shared_ptr<const nlohmann::json>& mappingJson,
+                                   const std::shared_ptr<const mqtt::lib::MqttMetrics::MappedPublishCounters>& mappedPublishCounters,
+                                   const std::string& topic,
+                                   const std::string& message,
+                                   uint8_t qoS) {
+        Worker& worker = *workers[std::hash<std::string>()(topic) % workers.size()];
+        const std::size_t jobBytes = topic.size() + message.size();
+
+        std::size_t dropped = 0;
+        bool queued = false;
+        {
+            const std::scoped_lock<std::mutex> lock(worker.mutex);
+
+            if (overflowPolicy == OverflowPolicy::DropOldestQoS0) {
+                while (!worker.qoS0Jobs.empty() && exceedsQueueLimits(worker, jobBytes)) {
+                    worker.queuedBytes -= worker.qoS0Jobs.front().topic.size() + worker.qoS0Jobs.front().message.size();
+                    worker.qoS0Jobs.pop_front();
+                    ++dropped;
+                }
+            }
+
+            if (!exceedsQueueLimits(worker, jobBytes)) {
+                (qoS == 0 ? worker.qoS0Jobs : worker.jobs)
+                    .push_back(Job{broker, mappingJson, mappedPublishCounters, topic, message, qoS, worker.nextSequence++});
+                worker.queuedBytes += jobBytes;
+                queued = true;
+            } else {
+                ++dropped;
+            }
+        }
+
+        if (queued) {
+            worker.condition.notify_one();
+        }
+
+        if (dropped > 0) {
+            mqtt::lib::MqttMetrics::instance().mappingDropped(dropped);
+        }
+    }
+
+    bool MappingWorkerPool::exceedsQueueLimits(const Worker& worker, std::size_t jobBytes) const {
+        const std::size_t queuedJobs = worker.qoS0Jobs.size() + worker.jobs.size();
+
+        return queuedJobs > 0 && (queuedJobs >= maxQueuedMessages || worker.queuedBytes + jobBytes > maxQueuedBytes);
+    }
+
+    std::vector<std::size_t> MappingWorkerPool::getQueueDepths() const {
+        std::vector<std::size_t> queueDepths;
+
+        for (const std::unique_ptr<Worker>& worker : workers) {
+            const std::scoped_lock<std::mutex> lock(worker->mutex);
+            queueDepths.push_back(worker->qoS0Jobs.size() + worker->jobs.size());
+        }
+
+        return queueDepths;
+    }
+
+    void MappingWorkerPool::work(Worker& worker) {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(worker.mutex);
+                worker.condition.wait(lock, [&worker]() -> bool {
+                    return worker.stopped || !worker.qoS0Jobs.empty() || !worker.jobs.empty();
+                });
+
+                if (worker.qoS0Jobs.empty() && worker.jobs.empty()) {
+                    break;
+                }
+
+                std::deque<Job>& jobs =
+                    worker.jobs.empty() || (!worker.qoS0Jobs.empty() && worker.qoS0Jobs.front().sequence < worker.jobs.front().sequence)
+                        ? worker.qoS0Jobs
+                        : worker.jobs;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                worker.queuedBytes -= job.topic.size() + job.message.size();
+            }
+
+            CollectingMapper collectingMapper(job.mappingJson, job.mappedPublishCounters);
+            collectingMapper.publishMappings(job.topic, job.message, job.qoS);
+
+            if (!collectingMapper.mappedPublishes.empty()) {
+                Completion* completion = new Completion{std::move(job.broker), {}, nullptr};
+                completion->mappedPublishes.reserve(collectingMapper.mappedPublishes.size());
+
+                for (auto& [topic, message, qoS, retain] : collectingMapper.mappedPublishes) {
+                    completion->mappedPublishes.push_back(MappedPublish{std::move(topic), message, qoS, retain});
+                }
+
+                complete(completion);
+            }
+        }
+    }
+
+    void MappingWorkerPool::complete(Completion* completion) {
+        Completion* previous = head.exchange(completion, std::memory_order_acq_rel);
+        previous->next.store(completion, std::memory_order_release);
+
+        const uint64_t one = 1;
+        if (write(eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            const std::scoped_lock<std::mutex> lock(mqtt::lib::logMutex);
+            PLOG(ERROR) << "write eventfd";
+        }
+    }
+
+    std::size_t MappingWorkerPool::drain() {
+        std::size_t count = 0;
+
+        uint64_t signaled = 0;
+        if (eventFd >= 0 && read(eventFd, &signaled, sizeof(signaled)) == sizeof(signaled)) {
+            mqtt::lib::MqttMetrics& metrics = mqtt::lib::MqttMetrics::instance();
+            WorkerFanout& workerFanout = WorkerFanout::instance();
+            RetainedStore& retainedStore = RetainedStore::instance();
+            SharedSubscriptions& sharedSubscriptions = SharedSubscriptions::instance();
+
+            // A producer between exchanging the head and linking its completion is caught by the next signal
+            for (Completion* next = tail->next.load(std::memory_order_acquire); next != nullptr;
+                 next = tail->next.load(std::memory_order_acquire)) {
+                if (tail != &stub) {
+                    delete tail;
+                }
+                tail = next;
+
+                for (const MappedPublish& mappedPublish : next->mappedPublishes) {
+                    metrics.publishSent(mappedPublish.topic.size() + mappedPublish.message.size());
+
+                    {
+                        const mqtt::lib::StageTimer stageTimer(metrics.latency(mqtt::lib::MqttMetrics::Stage::BrokerPublish));
+                        next->broker->publish(mappedPublish.topic, mappedPublish.message.str(), mappedPublish.qoS, mappedPublish.retain);
+                    }
+
+                    if (mappedPublish.retain) {
+                        retainedStore.put(mappedPublish.topic, mappedPublish.message.str(), mappedPublish.qoS);
+                    }
+                    sharedSubscriptions.publish(*next->broker, mappedPublish.topic, mappedPublish.message.str(), mappedPublish.qoS);
+
+                    if (workerFanout.isActive()) {
+                        workerFanout.forward(mappedPublish.topic, mappedPublish.message.str(), mappedPublish.qoS, mappedPublish.retain);
+                    }
+                }
+                next->mappedPublishes.clear();
+                next->broker.reset();
+
+                ++count;
+            }
+        }
+
+        return count;
+    }
+
+} // namespace mqtt::mqttbroker::lib
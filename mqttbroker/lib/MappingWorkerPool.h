@@ -0,0 +1,151 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MQTTBROKER_LIB_MAPPINGWORKERPOOL_H
+#define MQTTBROKER_LIB_MAPPINGWORKERPOOL_H
+
+namespace iot::mqtt::server::broker {
+    class Broker;
+}
+
+#include "lib/MqttMetrics.h"
+#include "lib/Payload.h"
+
+#include <nlohmann/json_fwd.hpp>
+
+//
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mqtt::mqttbroker::lib {
+
+    // Optional offloading of the mapping of received publishes to worker threads. Matching, payload parsing and template rendering of
+    // a publish, including the mappings of its mapped messages, run on a worker. The resulting messages are handed back through a
+    // lock-free multi-producer single-consumer queue. The workers signal an eventfd observed by the event loop, which publishes them by
+    // drain(). All publishes of one source topic are mapped by the same worker, thus their mapped messages keep the order in which the
+    // publishes arrived.
+    // The jobs queued per worker are bounded by a number of messages and bytes, thus a stalled worker can not exhaust the memory.
+    // These are the only queues bounded by the broker app, the per-client outbound queues of the sessions are owned by snode.c.
+    class MappingWorkerPool {
+    public:
+        enum class OverflowPolicy {
+            DropOldestQoS0, // drop queued QoS 0 publishes, oldest first, and the new publish if that does not make enough room
+            DropNewest      // drop the new publish
+        };
+
+    private:
+        MappingWorkerPool() = default;
+
+    public:
+        ~MappingWorkerPool();
+
+        MappingWorkerPool(const MappingWorkerPool&) = delete;
+        MappingWorkerPool& operator=(const MappingWorkerPool&) = delete;
+
+        static MappingWorkerPool& instance();
+
+        // Must be called before start(). A publish is always queued for an idle worker, even if it exceeds maxBytes on its own.
+        void setQueueLimits(std::size_t maxMessages, std::size_t maxBytes, OverflowPolicy overflowPolicy);
+
+        bool start(std::size_t workerCount);
+        void stop();
+        bool isRunning() const;
+
+        void submit(const std::shared_ptr<iot::mqtt::server::broker::Broker>& broker,
+                    const std::shared_ptr<const nlohmann::json>& mappingJson,
+                    const std::shared_ptr<const mqtt::lib::MqttMetrics::MappedPublishCounters>& mappedPublishCounters,
+                    const std::string& topic,
+                    const std::string& message,
+                    uint8_t qoS);
+
+        // Number of queued publishes of each worker
+        std::vector<std::size_t> getQueueDepths() const;
+
+        // Publishes the mapped messages of all completed jobs. Must be called on the event loop.
+        std::size_t drain();
+
+    private:
+        class EventReceiver;
+
+        struct MappedPublish {
+            std::string topic;
+            mqtt::lib::Payload message;
+            uint8_t qoS = 0;
+            bool retain = false;
+        };
+
+        struct Job {
+            std::shared_ptr<iot::mqtt::server::broker::Broker> broker;
+            std::shared_ptr<const nlohmann::json> mappingJson; // the snapshot is kept alive by the job across a reload
+            std::shared_ptr<const mqtt::lib::MqttMetrics::MappedPublishCounters> mappedPublishCounters;
+            std::string topic;
+            std::string message;
+            uint8_t qoS = 0;
+            uint64_t sequence = 0;
+        };
+
+        struct Completion {
+            std::shared_ptr<iot::mqtt::server::broker::Broker> broker;
+            std::vector<MappedPublish> mappedPublishes;
+            std::atomic<Completion*> next = nullptr;
+        };
+
+        struct Worker {
+            std::thread thread;
+            std::mutex mutex;
+            std::condition_variable condition;
+            // QoS 0 publishes are queued apart from the others, thus dropping the oldest of them is a pop_front(). The sequence
+            // numbers restore the order of arrival across both queues.
+            std::deque<Job> qoS0Jobs;
+            std::deque<Job> jobs;
+            uint64_t nextSequence = 0;
+            std::size_t queuedBytes = 0;
+            bool stopped = false;
+        };
+
+        bool exceedsQueueLimits(const Worker& worker, std::size_t jobBytes) const;
+
+        void work(Worker& worker);
+        void complete(Completion* completion);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        int eventFd = -1;
+        EventReceiver* eventReceiver = nullptr; // deletes itself once the event loop stops observing it
+
+        std::size_t maxQueuedMessages = 10000;
+        std::size_t maxQueuedBytes = 64 * 1024 * 1024;
+        OverflowPolicy overflowPolicy = OverflowPolicy::DropOldestQoS0;
+
+        // Intrusive MPSC queue of D. Vyukov: producers exchange the head, the consumer follows the next pointers from the tail
+        Completion stub;
+        std::atomic<Completion*> head = &stub;
+        Completion* tail = &stub;
+    };
+
+} // namespace mqtt::mqttbroker::lib
+
+#endif // MQTTBROKER_LIB_MAPPINGWORKERPOOL_H
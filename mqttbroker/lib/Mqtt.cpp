@@ -18,34 +18,208 @@
 
 #include "Mqtt.h"
 
+#include "lib/JsonMappingReader.h"
+#include "lib/MqttMetrics.h"
+#include "mqttbroker/lib/AdmissionControl.h"
+#include "mqttbroker/lib/MappingWorkerPool.h"
 #include "mqttbroker/lib/MqttModel.h"
+#include "mqttbroker/lib/RetainedStore.h"
+#include "mqttbroker/lib/SharedSubscriptions.h"
+#include "mqttbroker/lib/WorkerFanout.h"
 
+#include <core/socket/SocketConnection.h>
+#include <iot/mqtt/Topic.h>
+#include <iot/mqtt/packets/Connack.h>
+#include <iot/mqtt/packets/Connect.h>
 #include <iot/mqtt/packets/Publish.h>
+#include <iot/mqtt/packets/Subscribe.h>
+#include <iot/mqtt/packets/Unsubscribe.h>
 #include <iot/mqtt/server/broker/Broker.h>
 
+//
+
+#include <algorithm>
+#include <nlohmann/json.hpp>
+
 namespace mqtt::mqttbroker::lib {
 
-    Mqtt::Mqtt(const std::shared_ptr<iot::mqtt::server::broker::Broker>& broker, const nlohmann::json& mappingJson)
+    Mqtt::Mqtt(const std::shared_ptr<iot::mqtt::server::broker::Broker>& broker,
+               const std::shared_ptr<const nlohmann::json>& mappingJson,
+               const std::shared_ptr<const mqtt::lib::MqttMetrics::MappedPublishCounters>& mappedPublishCounters)
         : iot::mqtt::server::Mqtt(broker)
-        , mqtt::lib::MqttMapper(mappingJson) {
+        , mqtt::lib::MqttMapper(mappingJson, mappedPublishCounters) {
+    }
+
+    void Mqtt::takenOver() {
+        getSocketConnection()->close();
+    }
+
+    // Seconds a rejected connection is kept open, thus its client does not reconnect at once
+    static constexpr double rejectedCloseDelay = 5;
+
+    void Mqtt::onConnected() {
+        const AdmissionControl::Admission admission = AdmissionControl::instance().connected(getSocketConnection()->getInstanceName());
+
+        admissionPending = admission != AdmissionControl::Admission::Refused;
+        admittedFromReserve = admission == AdmissionControl::Admission::Reserved;
+
+        if (!admissionPending) {
+            // Answers the CONNECT in advance, it is not read anymore
+            sendConnack(MQTT_CONNACK_SERVERUNAVAILABLE, MQTT_SESSION_NEW);
+            reject();
+        }
     }
 
     void Mqtt::onConnect(const iot::mqtt::packets::Connect& connect) {
-        MqttModel::instance().addConnectedClient(this, connect);
+        AdmissionControl& admissionControl = AdmissionControl::instance();
+
+        if (admissionPending) {
+            admissionControl.released();
+            admissionPending = false;
+        }
+
+        // snode.c has answered the CONNECT already, thus a connection not entitled to the reserve is just closed
+        if (!rejected && admittedFromReserve &&
+            !admissionControl.reserveGranted(getSocketConnection()->getInstanceName(), getClientId(), connect.getCleanSession())) {
+            reject();
+        }
+
+        if (!rejected) {
+            cleanSession = connect.getCleanSession();
+
+            if (!cleanSession) {
+                admissionControl.persistentSessionConnected(getClientId());
+            }
+
+            SharedSubscriptions::instance().connected(getClientId(), cleanSession);
+
+            WorkerFanout& workerFanout = WorkerFanout::instance();
+            if (workerFanout.isActive()) {
+                workerFanout.connected(getClientId(), cleanSession);
+            }
+
+            MqttModel::instance().addConnectedClient(this, connect);
+        }
+    }
+
+    void Mqtt::reject() {
+        rejected = true;
+
+        mqtt::lib::MqttMetrics::instance().connectionRejected();
+
+        getSocketConnection()->shutdownRead();
+        closeTimer.emplace(core::timer::Timer::singleshotTimer(
+            [this]() -> void {
+                getSocketConnection()->close();
+            },
+            rejectedCloseDelay));
     }
 
     void Mqtt::onPublish(const iot::mqtt::packets::Publish& publish) {
-        publishMappings(publish);
+        mqtt::lib::MqttMetrics& metrics = mqtt::lib::MqttMetrics::instance();
+        const mqtt::lib::StageTimer stageTimer(metrics.latency(mqtt::lib::MqttMetrics::Stage::OnPublish));
+
+        metrics.publishReceived(publish.getTopic().size() + publish.getMessage().size());
+
+        if (publish.getRetain()) {
+            RetainedStore::instance().put(publish.getTopic(), publish.getMessage(), publish.getQoS());
+        }
+
+        SharedSubscriptions::instance().publish(*broker, publish.getTopic(), publish.getMessage(), publish.getQoS());
+
+        WorkerFanout& workerFanout = WorkerFanout::instance();
+        if (workerFanout.isActive()) {
+            workerFanout.forward(publish.getTopic(), publish.getMessage(), publish.getQoS(), publish.getRetain());
+        }
+
+        // Publishes received after a reload of the mapping file are mapped by the new mapping
+        setMappingJson(mqtt::lib::JsonMappingReader::getMappingJson(), mqtt::lib::JsonMappingReader::getMappedPublishCounters());
+
+        MappingWorkerPool& mappingWorkerPool = MappingWorkerPool::instance();
+
+        if (!mappingWorkerPool.isRunning()) {
+            publishMappings(publish);
+        } else if (!mappingJson->empty()) {
+            mappingWorkerPool.submit(
+                broker, mappingJson, mappedPublishCounters, publish.getTopic(), publish.getMessage(), publish.getQoS());
+        }
+    }
+
+    void Mqtt::onSubscribe(const iot::mqtt::packets::Subscribe& subscribe) {
+        RetainedStore& retainedStore = RetainedStore::instance();
+        SharedSubscriptions& sharedSubscriptions = SharedSubscriptions::instance();
+        WorkerFanout& workerFanout = WorkerFanout::instance();
+
+        for (const iot::mqtt::Topic& topic : subscribe.getTopics()) {
+            const uint8_t grantedQoS = std::min<uint8_t>(topic.getQoS(), SUBSCRIBTION_MAX_QOS);
+
+            if (workerFanout.isActive()) {
+                workerFanout.subscribe(getClientId(), topic.getName(), grantedQoS);
+            }
+
+            if (SharedSubscriptions::isShared(topic.getName())) {
+                sharedSubscriptions.subscribe(getClientId(), topic.getName(), grantedQoS);
+            } else if (retainedStore.isOpen()) {
+                retainedStore.restore(topic.getName(), getClientId(), grantedQoS, *broker);
+            }
+        }
+    }
+
+    void Mqtt::onUnsubscribe(const iot::mqtt::packets::Unsubscribe& unsubscribe) {
+        SharedSubscriptions& sharedSubscriptions = SharedSubscriptions::instance();
+        WorkerFanout& workerFanout = WorkerFanout::instance();
+
+        for (const std::string& topic : unsubscribe.getTopics()) {
+            if (workerFanout.isActive()) {
+                workerFanout.unsubscribe(getClientId(), topic);
+            }
+
+            if (SharedSubscriptions::isShared(topic)) {
+                sharedSubscriptions.unsubscribe(getClientId(), topic);
+            }
+        }
     }
 
     void Mqtt::onDisconnected() {
+        if (admissionPending) {
+            AdmissionControl::instance().released();
+        }
+
+        if (closeTimer) {
+            closeTimer->cancel();
+        }
+
+        WorkerFanout& workerFanout = WorkerFanout::instance();
+        if (workerFanout.isActive()) {
+            workerFanout.disconnected(getClientId(), cleanSession);
+        }
+
+        SharedSubscriptions::instance().disconnected(getClientId());
         MqttModel::instance().delDisconnectedClient(this);
     }
 
-    void Mqtt::publishMapping(const std::string& topic, const std::string& message, uint8_t qoS, bool retain) {
-        broker->publish(topic, message, qoS, retain);
+    void Mqtt::publishMapping(const std::string& topic, const mqtt::lib::Payload& message, uint8_t qoS, bool retain) {
+        mqtt::lib::MqttMetrics& metrics = mqtt::lib::MqttMetrics::instance();
+
+        metrics.publishSent(topic.size() + message.size());
+
+        {
+            const mqtt::lib::StageTimer stageTimer(metrics.latency(mqtt::lib::MqttMetrics::Stage::BrokerPublish));
+            broker->publish(topic, message.str(), qoS, retain);
+        }
+
+        if (retain) {
+            RetainedStore::instance().put(topic, message.str(), qoS);
+        }
+
+        SharedSubscriptions::instance().publish(*broker, topic, message.str(), qoS);
+
+        WorkerFanout& workerFanout = WorkerFanout::instance();
+        if (workerFanout.isActive()) {
+            workerFanout.forward(topic, message.str(), qoS, retain);
+        }
 
-        publishMappings(iot::mqtt::packets::Publish(getPacketIdentifier(), topic, message, qoS, false, retain));
+        publishMappings(topic, message.str(), qoS);
     }
 
 } // namespace mqtt::mqttbroker::lib
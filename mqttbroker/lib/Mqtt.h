@@ -25,17 +25,21 @@ namespace iot::mqtt {
     namespace packets {
         class Connect;
         class Publish;
+        class Subscribe;
+        class Unsubscribe;
     } // namespace packets
     namespace server::broker {
         class Broker;
     } // namespace server::broker
 } // namespace iot::mqtt
 
+#include <core/timer/Timer.h>
 #include <iot/mqtt/server/Mqtt.h>
 
 //
 
 #include <memory>
+#include <optional>
 #include <string>
 
 namespace mqtt::mqttbroker::lib {
@@ -44,18 +48,35 @@ namespace mqtt::mqttbroker::lib {
         : public iot::mqtt::server::Mqtt
         , public mqtt::lib::MqttMapper {
     public:
-        explicit Mqtt(const std::shared_ptr<iot::mqtt::server::broker::Broker>& broker, const nlohmann::json& mappingJson);
+        explicit Mqtt(const std::shared_ptr<iot::mqtt::server::broker::Broker>& broker,
+                      const std::shared_ptr<const nlohmann::json>& mappingJson,
+                      const std::shared_ptr<const mqtt::lib::MqttMetrics::MappedPublishCounters>& mappedPublishCounters);
+
+        // Closes the connection of a client which has connected again to another worker
+        void takenOver();
 
     private:
         // inherited from iot::mqtt::server::SocketContext - the plain and base MQTT broker
         void onConnect(const iot::mqtt::packets::Connect& connect) final;
         void onPublish(const iot::mqtt::packets::Publish& publish) final;
+        void onSubscribe(const iot::mqtt::packets::Subscribe& subscribe) final;
+        void onUnsubscribe(const iot::mqtt::packets::Unsubscribe& unsubscribe) final;
 
         // inherited from core::socket::SocketContext (the root class of all SocketContext classes) via iot::mqtt::server::SocketContext
+        void onConnected() final;
         void onDisconnected() final;
 
         // inherited from apps::mqtt::lib::MqttMapper
-        void publishMapping(const std::string& topic, const std::string& message, uint8_t qoS, bool retain) final;
+        void publishMapping(const std::string& topic, const mqtt::lib::Payload& message, uint8_t qoS, bool retain) final;
+
+        // Reads nothing more from the client and closes the connection delayed
+        void reject();
+
+        bool admissionPending = false; // counted by the AdmissionControl until the CONNECT arrives
+        bool admittedFromReserve = false;
+        bool rejected = false;
+        std::optional<core::timer::Timer> closeTimer;
+        bool cleanSession = true;
     };
 
 } // namespace mqtt::mqttbroker::lib
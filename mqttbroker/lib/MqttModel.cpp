@@ -18,6 +18,11 @@
 
 #include "MqttModel.h"
 
+#include "Mqtt.h"
+
+#include <core/socket/SocketAddress.h>
+#include <iot/mqtt/packets/Connect.h>
+
 namespace mqtt::mqttbroker::lib {
 
     MqttModel::MqttModel() {
@@ -30,15 +35,98 @@ namespace mqtt::mqttbroker::lib {
     }
 
     void MqttModel::addConnectedClient(mqtt::mqttbroker::lib::Mqtt* mqtt, const iot::mqtt::packets::Connect& connect) {
-        connectedClients[mqtt] = connect;
+        delDisconnectedClient(mqtt);
+
+        std::size_t slot = connectedClients.size();
+
+        if (!freeSlots.empty()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            connectedClients.emplace_back();
+        }
+
+        ConnectedClient& connectedClient = connectedClients[slot];
+
+        connectedClient.mqtt = mqtt;
+        connectedClient.listener = mqtt->getSocketConnection()->getInstanceName();
+        connectedClient.clientId = connect.getClientId();
+        connectedClient.localAddress = mqtt->getSocketConnection()->getLocalAddress().toString();
+        connectedClient.remoteAddress = mqtt->getSocketConnection()->getRemoteAddress().toString();
+        connectedClient.connectTime = std::chrono::system_clock::now();
+        connectedClient.keepAlive = connect.getKeepAlive();
+        connectedClient.protocol = connect.getProtocol();
+        connectedClient.level = connect.getLevel();
+
+        slotByMqtt[mqtt] = slot;
+        slotByClientId[connectedClient.clientId] = slot; // a reconnecting client takes over the client id
+        slotsByRemoteAddress.emplace(connectedClient.remoteAddress, slot);
+
+        ++connectedClientCountByListener[connectedClient.listener];
     }
 
     void MqttModel::delDisconnectedClient(mqtt::mqttbroker::lib::Mqtt* mqtt) {
-        connectedClients.erase(mqtt);
+        const auto mqttIt = slotByMqtt.find(mqtt);
+
+        if (mqttIt != slotByMqtt.end()) {
+            const std::size_t slot = mqttIt->second;
+            ConnectedClient& connectedClient = connectedClients[slot];
+
+            const auto clientIdIt = slotByClientId.find(connectedClient.clientId);
+            if (clientIdIt != slotByClientId.end() && clientIdIt->second == slot) {
+                slotByClientId.erase(clientIdIt);
+            }
+
+            auto [first, last] = slotsByRemoteAddress.equal_range(connectedClient.remoteAddress);
+            for (; first != last; ++first) {
+                if (first->second == slot) {
+                    slotsByRemoteAddress.erase(first);
+                    break;
+                }
+            }
+
+            slotByMqtt.erase(mqttIt);
+
+            --connectedClientCountByListener[connectedClient.listener];
+
+            connectedClient = ConnectedClient();
+            freeSlots.push_back(slot);
+        }
     }
 
-    const std::map<mqtt::mqttbroker::lib::Mqtt*, iot::mqtt::packets::Connect>& MqttModel::getConnectedClinets() const {
+    const std::vector<ConnectedClient>& MqttModel::getConnectedClients() const {
         return connectedClients;
     }
 
+    std::size_t MqttModel::getConnectedClientCount() const {
+        return slotByMqtt.size();
+    }
+
+    const std::map<std::string, std::size_t>& MqttModel::getConnectedClientCountByListener() const {
+        return connectedClientCountByListener;
+    }
+
+    const ConnectedClient* MqttModel::getConnectedClient(mqtt::mqttbroker::lib::Mqtt* mqtt) const {
+        const auto it = slotByMqtt.find(mqtt);
+
+        return it != slotByMqtt.end() ? &connectedClients[it->second] : nullptr;
+    }
+
+    const ConnectedClient* MqttModel::getConnectedClientByClientId(const std::string& clientId) const {
+        const auto it = slotByClientId.find(clientId);
+
+        return it != slotByClientId.end() ? &connectedClients[it->second] : nullptr;
+    }
+
+    std::vector<const ConnectedClient*> MqttModel::getConnectedClientsByRemoteAddress(const std::string& remoteAddress) const {
+        std::vector<const ConnectedClient*> clients;
+
+        auto [first, last] = slotsByRemoteAddress.equal_range(remoteAddress);
+        for (; first != last; ++first) {
+            clients.push_back(&connectedClients[first->second]);
+        }
+
+        return clients;
+    }
+
 } // namespace mqtt::mqttbroker::lib
@@ -23,14 +23,38 @@ namespace mqtt::mqttbroker::lib {
     class Mqtt;
 }
 
-#include <iot/mqtt/packets/Connect.h>
+namespace iot::mqtt::packets {
+    class Connect;
+}
 
 //
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace mqtt::mqttbroker::lib {
 
+    // The fields of a connected client shown by the web views. Addresses are rendered once on connect.
+    struct ConnectedClient {
+        mqtt::mqttbroker::lib::Mqtt* mqtt = nullptr; // nullptr for a free slot
+        std::string listener;                        // instance name of the server or web view the client is connected to
+        std::string clientId;
+        std::string localAddress;
+        std::string remoteAddress;
+        std::chrono::system_clock::time_point connectTime;
+        uint16_t keepAlive = 0;
+        std::string protocol;
+        uint8_t level = 0;
+    };
+
+    // Registry of the connected clients. Clients are stored in the slots of a slab, slots of disconnected clients are reused via a
+    // free list, thus adding and deleting a client is O(1) without a node allocation. Hash indexes map the Mqtt instance, the client
+    // id and the remote address to the slot of a client.
     class MqttModel {
     private:
         MqttModel();
@@ -41,10 +65,24 @@ namespace mqtt::mqttbroker::lib {
         void addConnectedClient(mqtt::mqttbroker::lib::Mqtt* mqtt, const iot::mqtt::packets::Connect& connect);
         void delDisconnectedClient(mqtt::mqttbroker::lib::Mqtt* mqtt);
 
-        const std::map<mqtt::mqttbroker::lib::Mqtt*, iot::mqtt::packets::Connect>& getConnectedClinets() const;
+        // All slots including the free ones (ConnectedClient::mqtt == nullptr). A slot index stays valid until the client disconnects.
+        const std::vector<ConnectedClient>& getConnectedClients() const;
+        std::size_t getConnectedClientCount() const;
+        const std::map<std::string, std::size_t>& getConnectedClientCountByListener() const;
+
+        const ConnectedClient* getConnectedClient(mqtt::mqttbroker::lib::Mqtt* mqtt) const;
+        const ConnectedClient* getConnectedClientByClientId(const std::string& clientId) const;
+        std::vector<const ConnectedClient*> getConnectedClientsByRemoteAddress(const std::string& remoteAddress) const;
 
     protected:
-        std::map<mqtt::mqttbroker::lib::Mqtt*, iot::mqtt::packets::Connect> connectedClients;
+        std::vector<ConnectedClient> connectedClients;
+        std::vector<std::size_t> freeSlots;
+
+        std::unordered_map<mqtt::mqttbroker::lib::Mqtt*, std::size_t> slotByMqtt;
+        std::unordered_map<std::string, std::size_t> slotByClientId;
+        std::unordered_multimap<std::string, std::size_t> slotsByRemoteAddress;
+
+        std::map<std::string, std::size_t> connectedClientCountByListener;
     };
 
 } // namespace mqtt::mqttbroker::lib
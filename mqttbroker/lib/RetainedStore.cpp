@@ -0,0 +1,858 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "RetainedStore.h"
+
+#include "lib/LogMutex.h"
+#include "mqttbroker/lib/TopicFilter.h"
+
+#include <core/timer/Timer.h>
+#include <iot/mqtt/server/broker/Broker.h>
+#include <iot/mqtt/server/broker/Message.h>
+#include <log/Logger.h>
+
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+namespace mqtt::mqttbroker::lib {
+
+    namespace {
+
+        constexpr uint32_t recordMagic = 0x314e5452; // "RTN1"
+        constexpr uint32_t indexMagic = 0x31585452;  // "RTX1"
+
+        // Logs smaller than this are never compacted while running
+        constexpr uint64_t compactionThreshold = 64 * 1024 * 1024;
+
+        // Stored topics visited and message bytes read per restore batch
+        constexpr std::size_t maxRestoreTopics = 256;
+        constexpr std::size_t maxRestoreBytes = 1024 * 1024;
+
+        struct RecordHeader {
+            uint32_t magic;
+            uint32_t topicLength;
+            uint32_t messageLength;
+            uint8_t qoS;
+            uint8_t tombstone;
+            uint16_t reserved;
+            uint64_t checksum;
+        };
+
+        static_assert(sizeof(RecordHeader) == 24);
+
+        // The index file is the header, the entries sorted by topic and the topics they refer to
+        struct IndexHeader {
+            uint32_t magic;
+            uint32_t reserved;
+            uint64_t logInode; // the index file belongs to this log only, a log replaced by a compaction has another inode
+            uint64_t logSize;
+            uint64_t liveSize;
+            uint64_t count;
+        };
+
+        struct IndexEntry {
+            uint64_t topicOffset;
+            uint64_t recordOffset;
+            uint32_t topicLength;
+            uint32_t messageLength;
+            uint8_t qoS;
+            uint8_t reserved[7];
+        };
+
+        static_assert(sizeof(IndexHeader) == 40);
+        static_assert(sizeof(IndexEntry) == 32);
+
+        uint64_t recordSize(std::size_t topicLength, std::size_t messageLength) {
+            return sizeof(RecordHeader) + topicLength + messageLength;
+        }
+
+        // FNV-1a 64 of topic and message
+        uint64_t checksum(std::string_view topic, std::string_view message) {
+            uint64_t hash = 0xcbf29ce484222325;
+
+            for (const std::string_view part : {topic, message}) {
+                for (const char c : part) {
+                    hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+                }
+            }
+
+            return hash;
+        }
+
+        bool writeAll(int fd, const char* data, std::size_t length) {
+            while (length > 0) {
+                const ssize_t written = write(fd, data, length);
+
+                if (written < 0 && errno != EINTR) {
+                    return false;
+                }
+                if (written > 0) {
+                    data += written;
+                    length -= static_cast<std::size_t>(written);
+                }
+            }
+
+            return true;
+        }
+
+        bool writeAll(int fd, iovec* iov, int iovcnt) {
+            while (iovcnt > 0) {
+                const ssize_t written = writev(fd, iov, iovcnt);
+
+                if (written < 0 && errno != EINTR) {
+                    return false;
+                }
+
+                std::size_t remaining = written > 0 ? static_cast<std::size_t>(written) : 0;
+                for (; iovcnt > 0 && remaining >= iov->iov_len; ++iov, --iovcnt) {
+                    remaining -= iov->iov_len;
+                }
+                if (iovcnt > 0) {
+                    iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+                    iov->iov_len -= remaining;
+                }
+            }
+
+            return true;
+        }
+
+        bool readAll(int fd, char* data, std::size_t length, uint64_t offset) {
+            while (length > 0) {
+                const ssize_t got = pread(fd, data, length, static_cast<off_t>(offset));
+
+                if (got == 0 || (got < 0 && errno != EINTR)) {
+                    return false;
+                }
+                if (got > 0) {
+                    data += got;
+                    length -= static_cast<std::size_t>(got);
+                    offset += static_cast<uint64_t>(got);
+                }
+            }
+
+            return true;
+        }
+
+        // Collects the entries of an index file in topic order
+        struct IndexBuilder {
+            std::vector<IndexEntry> entries;
+            std::string topics;
+
+            void add(std::string_view topic, uint64_t recordOffset, uint32_t messageLength, uint8_t qoS) {
+                entries.push_back(IndexEntry{topics.size(), recordOffset, static_cast<uint32_t>(topic.size()), messageLength, qoS, {}});
+                topics.append(topic);
+            }
+
+            // Written to a temporary file which replaces indexPath, thus a crash leaves either the old or the new index file
+            bool write(const std::string& indexPath, uint64_t logInode, uint64_t logSize, uint64_t liveSize) const {
+                const std::string tmpPath = indexPath + ".tmp";
+                const int indexFd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+                bool success = indexFd >= 0;
+
+                if (success) {
+                    const IndexHeader header{indexMagic, 0, logInode, logSize, liveSize, entries.size()};
+
+                    iovec iov[] = {{const_cast<IndexHeader*>(&header), sizeof(header)},
+                                   {const_cast<IndexEntry*>(entries.data()), entries.size() * sizeof(IndexEntry)},
+                                   {const_cast<char*>(topics.data()), topics.size()}};
+
+                    success = writeAll(indexFd, iov, 3) && fdatasync(indexFd) == 0;
+                    ::close(indexFd);
+
+                    success = success && std::rename(tmpPath.c_str(), indexPath.c_str()) == 0;
+                    if (!success) {
+                        unlink(tmpPath.c_str());
+                    }
+                }
+
+                return success;
+            }
+        };
+
+    } // namespace
+
+    std::string_view RetainedStore::IndexFile::topic(uint64_t i) const {
+        IndexEntry indexEntry{};
+        std::memcpy(&indexEntry, data + sizeof(IndexHeader) + i * sizeof(IndexEntry), sizeof(indexEntry));
+
+        const uint64_t topicsOffset = sizeof(IndexHeader) + count * sizeof(IndexEntry);
+
+        // An entry pointing outside of the file is only found in a corrupt index file
+        return indexEntry.topicOffset + indexEntry.topicLength <= size - topicsOffset
+                   ? std::string_view(data + topicsOffset + indexEntry.topicOffset, indexEntry.topicLength)
+                   : std::string_view();
+    }
+
+    RetainedStore::Entry RetainedStore::IndexFile::entry(uint64_t i) const {
+        IndexEntry indexEntry{};
+        std::memcpy(&indexEntry, data + sizeof(IndexHeader) + i * sizeof(IndexEntry), sizeof(indexEntry));
+
+        return Entry{indexEntry.recordOffset, indexEntry.messageLength, indexEntry.qoS, false, false};
+    }
+
+    uint64_t RetainedStore::IndexFile::lowerBound(std::string_view topic) const {
+        uint64_t first = 0;
+        uint64_t length = count;
+
+        while (length > 0) {
+            const uint64_t half = length / 2;
+
+            if (this->topic(first + half) < topic) {
+                first += half + 1;
+                length -= half + 1;
+            } else {
+                length = half;
+            }
+        }
+
+        return first;
+    }
+
+    bool RetainedStore::IndexFile::find(std::string_view topic, Entry& entry) const {
+        const uint64_t i = lowerBound(topic);
+        const bool found = i < count && this->topic(i) == topic;
+
+        if (found) {
+            entry = this->entry(i);
+        }
+
+        return found;
+    }
+
+    RetainedStore::~RetainedStore() {
+        close();
+    }
+
+    RetainedStore& RetainedStore::instance() {
+        static RetainedStore retainedStore;
+
+        return retainedStore;
+    }
+
+    bool RetainedStore::open(const std::string& path) {
+        if (fd < 0) {
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+            if (fd >= 0) {
+                this->path = path;
+
+                struct stat st {};
+                bool success = fstat(fd, &st) == 0;
+
+                if (success) {
+                    const bool indexed = loadIndexFile(static_cast<uint64_t>(st.st_ino), static_cast<uint64_t>(st.st_size));
+
+                    liveSize = indexed ? indexFile.liveSize : 0;
+                    success = replay(indexed ? indexFile.logSize : 0);
+                } else {
+                    PLOG(ERROR) << "Retained store " << path;
+                }
+
+                if (success) {
+                    VLOG(0) << "Retained store " << path << ": " << indexFile.count << " indexed topics, " << index.size()
+                            << " changed since";
+
+                    backgroundThread = std::thread(&RetainedStore::background, this);
+                } else {
+                    unloadIndexFile();
+                    index.clear();
+                    ::close(fd);
+                    fd = -1;
+                }
+            } else {
+                PLOG(ERROR) << "Retained store " << path;
+            }
+        }
+
+        return fd >= 0;
+    }
+
+    bool RetainedStore::isOpen() const {
+        return fd >= 0;
+    }
+
+    void RetainedStore::close() {
+        if (fd >= 0) {
+            stopBackground();
+            restores.clear();
+
+            if (compaction != nullptr) {
+                finishCompaction(*compaction);
+                compaction.reset();
+            }
+            if (fd >= 0 && fileSize > liveSize) {
+                const std::shared_ptr<Compaction> finalCompaction = startCompaction();
+
+                runCompaction(path, *finalCompaction);
+                finishCompaction(*finalCompaction);
+            } else if (fd >= 0 && (indexFile.data == nullptr || fileSize > indexFile.logSize) && !writeIndexFile()) {
+                PLOG(ERROR) << "Retained store index " << path << ".index";
+            }
+            if (fd >= 0 && fdatasync(fd) < 0) {
+                PLOG(ERROR) << "Retained store " << path;
+            }
+
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+
+            unloadIndexFile();
+            index.clear();
+            fileSize = 0;
+            liveSize = 0;
+            dirty = false;
+        }
+    }
+
+    bool RetainedStore::loadIndexFile(uint64_t logInode, uint64_t logSize) {
+        const std::string indexPath = path + ".index";
+        const int indexFd = ::open(indexPath.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (indexFd >= 0) {
+            struct stat st {};
+
+            if (fstat(indexFd, &st) == 0 && static_cast<uint64_t>(st.st_size) >= sizeof(IndexHeader)) {
+                const std::size_t size = static_cast<std::size_t>(st.st_size);
+                void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, indexFd, 0);
+
+                if (mapped != MAP_FAILED) {
+                    IndexHeader header{};
+                    std::memcpy(&header, mapped, sizeof(header));
+
+                    if (header.magic == indexMagic && header.logInode == logInode && header.logSize <= logSize &&
+                        header.count <= (size - sizeof(IndexHeader)) / sizeof(IndexEntry)) {
+                        indexFile = IndexFile{static_cast<const char*>(mapped), size, header.count, header.logSize, header.liveSize};
+                    } else {
+                        LOG(WARNING) << "Retained store index " << indexPath << " does not match the log, scanning the log";
+                        munmap(mapped, size);
+                    }
+                }
+            }
+
+            ::close(indexFd);
+        }
+
+        return indexFile.data != nullptr;
+    }
+
+    void RetainedStore::unloadIndexFile() {
+        if (indexFile.data != nullptr) {
+            munmap(const_cast<char*>(indexFile.data), indexFile.size);
+        }
+
+        indexFile = IndexFile{};
+    }
+
+    bool RetainedStore::writeIndexFile() const {
+        struct stat st {};
+        bool success = fstat(fd, &st) == 0;
+
+        if (success) {
+            IndexBuilder indexBuilder;
+
+            forEachTopic("", [&indexBuilder](std::string_view topic, const Entry& entry) -> bool {
+                indexBuilder.add(topic, entry.offset, entry.messageLength, entry.qoS);
+                return true;
+            });
+
+            success = indexBuilder.write(path + ".index", static_cast<uint64_t>(st.st_ino), fileSize, liveSize);
+        }
+
+        return success;
+    }
+
+    bool RetainedStore::replay(uint64_t from) {
+        bool success = true;
+
+        struct stat st {};
+        if (fstat(fd, &st) == 0) {
+            const uint64_t size = static_cast<uint64_t>(st.st_size);
+            uint64_t offset = from;
+            uint64_t skipped = 0;
+
+            if (size > from) {
+                void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (mapped != MAP_FAILED) {
+                    const char* data = static_cast<const char*>(mapped);
+
+                    while (offset + sizeof(RecordHeader) <= size) {
+                        RecordHeader header{};
+                        std::memcpy(&header, data + offset, sizeof(header));
+
+                        const bool fits = header.magic == recordMagic &&
+                                          recordSize(header.topicLength, header.messageLength) <= size - offset;
+                        const std::string_view topic(data + offset + sizeof(header), fits ? header.topicLength : 0);
+                        const std::string_view message(topic.data() + topic.size(), fits ? header.messageLength : 0);
+
+                        const bool valid = fits && header.checksum == checksum(topic, message);
+
+                        if (valid) {
+                            apply(topic,
+                                  offset,
+                                  header.messageLength,
+                                  header.qoS,
+                                  header.tombstone != 0,
+                                  false);
+
+                            offset += recordSize(header.topicLength, header.messageLength);
+                        } else {
+                            // Resynchronises to the next record header, the skipped bytes are dropped by the next compaction
+                            const void* next = memmem(data + offset + 1, size - offset - 1, &recordMagic, sizeof(recordMagic));
+                            const uint64_t nextOffset =
+                                next != nullptr ? static_cast<uint64_t>(static_cast<const char*>(next) - data) : size;
+
+                            skipped += nextOffset - offset;
+                            offset = nextOffset;
+                        }
+                    }
+
+                    munmap(mapped, size);
+                } else {
+                    PLOG(ERROR) << "Retained store " << path;
+                    success = false;
+                }
+            }
+
+            if (success) {
+                skipped += size > offset ? size - offset : 0;
+
+                if (skipped > 0) {
+                    LOG(WARNING) << "Retained store " << path << ": skipped " << skipped << " bytes of corrupt or incomplete records";
+                }
+
+                fileSize = size;
+            }
+        } else {
+            PLOG(ERROR) << "Retained store " << path;
+            success = false;
+        }
+
+        return success;
+    }
+
+    void RetainedStore::apply(std::string_view topic, uint64_t offset, uint32_t messageLength, uint8_t qoS, bool tombstone, bool inBroker) {
+        Entry previous{};
+        if (lookup(topic, previous)) {
+            liveSize -= recordSize(topic.size(), previous.messageLength);
+        }
+
+        if (!tombstone) {
+            index.insert_or_assign(std::string(topic), Entry{offset, messageLength, qoS, inBroker, false});
+            liveSize += recordSize(topic.size(), messageLength);
+        } else if (Entry indexed{}; indexFile.find(topic, indexed)) {
+            index.insert_or_assign(std::string(topic), Entry{offset, 0, 0, false, true});
+        } else if (const Index::iterator it = index.find(topic); it != index.end()) {
+            index.erase(it);
+        }
+    }
+
+    bool RetainedStore::lookup(std::string_view topic, Entry& entry) const {
+        const Index::const_iterator it = index.find(topic);
+
+        bool found = false;
+
+        if (it != index.end()) {
+            found = !it->second.removed;
+            entry = it->second;
+        } else {
+            found = indexFile.find(topic, entry);
+        }
+
+        return found;
+    }
+
+    void RetainedStore::forEachTopic(std::string_view topic, const std::function<bool(std::string_view, const Entry&)>& visit) const {
+        Index::const_iterator it = index.lower_bound(topic);
+        uint64_t i = indexFile.lowerBound(topic);
+
+        bool more = true;
+        while (more && (it != index.end() || i < indexFile.count)) {
+            const std::string_view indexedTopic = i < indexFile.count ? indexFile.topic(i) : std::string_view();
+
+            if (i < indexFile.count && (it == index.end() || indexedTopic < it->first)) {
+                more = visit(indexedTopic, indexFile.entry(i));
+                ++i;
+            } else {
+                if (i < indexFile.count && indexedTopic == it->first) {
+                    ++i; // changed since the index file has been written
+                }
+                if (!it->second.removed) {
+                    more = visit(it->first, it->second);
+                }
+                ++it;
+            }
+        }
+    }
+
+    bool RetainedStore::append(std::string_view topic, std::string_view message, uint8_t qoS, bool tombstone, uint64_t& offset) {
+        RecordHeader header{recordMagic,
+                            static_cast<uint32_t>(topic.size()),
+                            static_cast<uint32_t>(message.size()),
+                            qoS,
+                            static_cast<uint8_t>(tombstone ? 1 : 0),
+                            0,
+                            checksum(topic, message)};
+
+        // Written straight from the buffers of the caller, the message is not copied into a record
+        iovec iov[] = {{&header, sizeof(header)},
+                       {const_cast<char*>(topic.data()), topic.size()},
+                       {const_cast<char*>(message.data()), message.size()}};
+
+        const bool success = writeAll(fd, iov, 3);
+
+        if (success) {
+            offset = fileSize;
+            fileSize += recordSize(topic.size(), message.size());
+            dirty = true;
+        } else {
+            PLOG(ERROR) << "Retained store " << path;
+        }
+
+        return success;
+    }
+
+    void RetainedStore::put(std::string_view topic, std::string_view message, uint8_t qoS) {
+        if (fd >= 0) {
+            Entry previous{};
+            uint64_t offset = 0;
+
+            if ((!message.empty() || lookup(topic, previous)) && append(topic, message, qoS, message.empty(), offset)) {
+                apply(topic, offset, static_cast<uint32_t>(message.size()), qoS, message.empty(), true);
+            }
+        }
+    }
+
+    bool RetainedStore::readMessage(std::string_view topic, const Entry& entry, std::string& message) const {
+        std::string record(recordSize(topic.size(), entry.messageLength), '\0');
+
+        bool success = readAll(fd, record.data(), record.size(), entry.offset);
+
+        if (success) {
+            RecordHeader header{};
+            std::memcpy(&header, record.data(), sizeof(header));
+
+            message.assign(record, sizeof(RecordHeader) + topic.size());
+
+            success = header.magic == recordMagic && header.checksum == checksum(topic, message);
+        }
+
+        if (!success) {
+            LOG(ERROR) << "Retained store " << path << ": corrupt record for topic " << topic;
+        }
+
+        return success;
+    }
+
+    void RetainedStore::restore(const std::string& topicFilter,
+                                const std::string& clientId,
+                                uint8_t qoS,
+                                iot::mqtt::server::broker::Broker& broker) {
+        if (fd >= 0) {
+            // All matching topics start with the part of the filter before its first wildcard, without its trailing '/' for "a/#"
+            std::string prefix = topicFilter.substr(0, topicFilter.find_first_of("+#"));
+            if (prefix.ends_with('/')) {
+                prefix.pop_back();
+            }
+
+            restores.push_back(Restore{topicFilter, prefix, clientId, qoS, &broker, prefix});
+
+            if (!restoreScheduled) {
+                processRestores();
+            }
+        }
+    }
+
+    void RetainedStore::processRestores() {
+        std::size_t topics = 0;
+        std::size_t bytes = 0;
+
+        while (!restores.empty() && topics < maxRestoreTopics && bytes < maxRestoreBytes) {
+            Restore& restore = restores.front();
+            bool complete = true;
+
+            forEachTopic(restore.next, [this, &restore, &topics, &bytes, &complete](std::string_view topic, const Entry& entry) -> bool {
+                bool more = topic.starts_with(restore.prefix);
+
+                if (more && (topics >= maxRestoreTopics || bytes >= maxRestoreBytes)) {
+                    restore.next = topic;
+                    complete = false;
+                    more = false;
+                } else if (more) {
+                    ++topics;
+
+                    if (!entry.inBroker && matchesTopicFilter(restore.topicFilter, topic)) {
+                        std::string message;
+
+                        if (readMessage(topic, entry, message)) {
+                            iot::mqtt::server::broker::Message retainedMessage(std::string(topic), message, entry.qoS, true);
+
+                            restore.broker->sendPublish(restore.clientId, retainedMessage, std::min(entry.qoS, restore.qoS), true);
+                        }
+                        bytes += entry.messageLength;
+                    }
+                }
+
+                return more;
+            });
+
+            if (complete) {
+                restores.pop_front();
+            }
+        }
+
+        if (!restores.empty() && !restoreScheduled) {
+            restoreScheduled = true;
+
+            core::timer::Timer::singleshotTimer(
+                [this]() -> void {
+                    restoreScheduled = false;
+                    processRestores();
+                },
+                0);
+        }
+    }
+
+    std::shared_ptr<RetainedStore::Compaction> RetainedStore::startCompaction() const {
+        std::shared_ptr<Compaction> newCompaction = std::make_shared<Compaction>();
+
+        newCompaction->end = fileSize;
+        newCompaction->readFd = dup(fd);
+
+        forEachTopic("", [&newCompaction](std::string_view topic, const Entry& entry) -> bool {
+            newCompaction->records.emplace_back(entry.offset, recordSize(topic.size(), entry.messageLength));
+            return true;
+        });
+
+        return newCompaction;
+    }
+
+    void RetainedStore::runCompaction(const std::string& path, Compaction& compaction) {
+        compaction.compactFd = ::open((path + ".compact").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        bool success = compaction.readFd >= 0 && compaction.compactFd >= 0;
+
+        IndexBuilder indexBuilder;
+        compaction.offsetMap.reserve(compaction.records.size());
+
+        std::string record;
+        for (std::size_t i = 0; success && i < compaction.records.size(); ++i) {
+            record.resize(compaction.records[i].second);
+
+            success = readAll(compaction.readFd, record.data(), record.size(), compaction.records[i].first) &&
+                      writeAll(compaction.compactFd, record.data(), record.size());
+
+            if (success) {
+                RecordHeader header{};
+                std::memcpy(&header, record.data(), sizeof(header));
+
+                indexBuilder.add(std::string_view(record.data() + sizeof(header), header.topicLength),
+                                 compaction.compactSize,
+                                 header.messageLength,
+                                 header.qoS);
+            }
+
+            compaction.offsetMap.emplace_back(compaction.records[i].first, compaction.compactSize);
+            compaction.compactSize += record.size();
+        }
+
+        std::sort(compaction.offsetMap.begin(), compaction.offsetMap.end());
+
+        struct stat st {};
+        compaction.success = success && fdatasync(compaction.compactFd) == 0 && fstat(compaction.compactFd, &st) == 0 &&
+                             indexBuilder.write(path + ".index.compact",
+                                                static_cast<uint64_t>(st.st_ino),
+                                                compaction.compactSize,
+                                                compaction.compactSize);
+
+        if (compaction.readFd >= 0) {
+            ::close(compaction.readFd);
+            compaction.readFd = -1;
+        }
+
+        compaction.done.store(true, std::memory_order_release);
+    }
+
+    void RetainedStore::finishCompaction(Compaction& compaction) {
+        const std::string compactPath = path + ".compact";
+        const std::string compactIndexPath = path + ".index.compact";
+
+        bool success = compaction.success;
+
+        if (success && fileSize > compaction.end) {
+            // Records appended while compacting, they are replayed behind the index file when the store is opened again
+            std::string tail(fileSize - compaction.end, '\0');
+
+            success = readAll(fd, tail.data(), tail.size(), compaction.end) && writeAll(compaction.compactFd, tail.data(), tail.size());
+        }
+
+        // The index file is useless without the compacted log, as it refers to its inode
+        success = success && std::rename(compactPath.c_str(), path.c_str()) == 0;
+        success = success && std::rename(compactIndexPath.c_str(), (path + ".index").c_str()) == 0;
+
+        if (compaction.compactFd >= 0) {
+            ::close(compaction.compactFd);
+            compaction.compactFd = -1;
+        }
+
+        if (success) {
+            const int newFd = ::open(path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+            struct stat st {};
+
+            if (newFd >= 0 && fstat(newFd, &st) == 0) {
+                ::close(fd);
+                fd = newFd;
+
+                const uint64_t compactedSize = compaction.compactSize + (fileSize - compaction.end);
+
+                unloadIndexFile();
+                loadIndexFile(static_cast<uint64_t>(st.st_ino), compactedSize);
+
+                // Entries unchanged since the snapshot are found in the new index file, all others have been appended behind it. Only
+                // the entries changed since, and those published to the broker, are kept.
+                for (Index::iterator it = index.begin(); it != index.end();) {
+                    Entry& entry = it->second;
+
+                    if (entry.offset >= compaction.end) {
+                        entry.offset = entry.offset - compaction.end + compaction.compactSize;
+                        ++it;
+                    } else if (!entry.removed && entry.inBroker) {
+                        entry.offset = std::lower_bound(compaction.offsetMap.begin(),
+                                                        compaction.offsetMap.end(),
+                                                        std::make_pair(entry.offset, uint64_t{0}))
+                                           ->second;
+                        ++it;
+                    } else {
+                        it = index.erase(it);
+                    }
+                }
+
+                VLOG(0) << "Retained store " << path << " compacted from " << fileSize << " to " << compactedSize << " bytes";
+
+                fileSize = compactedSize;
+                dirty = true; // the copied tail is not synced yet
+            } else {
+                // The old descriptor still refers to the replaced log, whose offsets are outdated now
+                PLOG(ERROR) << "Retained store " << path;
+                if (newFd >= 0) {
+                    ::close(newFd);
+                }
+                ::close(fd);
+                fd = -1;
+                unloadIndexFile();
+                index.clear();
+            }
+        } else {
+            PLOG(ERROR) << "Retained store compaction " << compactPath;
+            unlink(compactPath.c_str());
+            unlink(compactIndexPath.c_str());
+        }
+    }
+
+    void RetainedStore::sync() {
+        if (fd >= 0) {
+            if (compaction != nullptr && compaction->done.load(std::memory_order_acquire)) {
+                finishCompaction(*compaction);
+                compaction.reset();
+            }
+
+            if (fd >= 0 && dirty) {
+                // A completed compaction replaces the descriptor, the duplicate stays valid until it is synced
+                const int syncFd = dup(fd);
+
+                if (syncFd >= 0) {
+                    runInBackground([syncFd, path = path]() -> void {
+                        if (fdatasync(syncFd) < 0) {
+                            const std::scoped_lock<std::mutex> lock(mqtt::lib::logMutex);
+                            PLOG(ERROR) << "Retained store " << path;
+                        }
+                        ::close(syncFd);
+                    });
+                } else {
+                    PLOG(ERROR) << "Retained store " << path;
+                }
+                dirty = false;
+            }
+
+            if (fd >= 0 && compaction == nullptr && fileSize > compactionThreshold && fileSize > 2 * liveSize) {
+                compaction = startCompaction();
+
+                runInBackground([path = path, compaction = compaction]() -> void {
+                    runCompaction(path, *compaction);
+                });
+            }
+        }
+    }
+
+    void RetainedStore::runInBackground(std::function<void()> task) {
+        {
+            const std::scoped_lock<std::mutex> lock(backgroundMutex);
+            backgroundTasks.push_back(std::move(task));
+        }
+        backgroundCondition.notify_one();
+    }
+
+    // Runs the queued tasks before returning
+    void RetainedStore::stopBackground() {
+        if (backgroundThread.joinable()) {
+            {
+                const std::scoped_lock<std::mutex> lock(backgroundMutex);
+                backgroundStopped = true;
+            }
+            backgroundCondition.notify_one();
+
+            backgroundThread.join();
+            backgroundStopped = false;
+        }
+    }
+
+    void RetainedStore::background() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(backgroundMutex);
+                backgroundCondition.wait(lock, [this]() -> bool {
+                    return backgroundStopped || !backgroundTasks.empty();
+                });
+
+                if (backgroundTasks.empty()) {
+                    break;
+                }
+
+                task = std::move(backgroundTasks.front());
+                backgroundTasks.pop_front();
+            }
+
+            task();
+        }
+    }
+
+} // namespace mqtt::mqttbroker::lib
@@ -0,0 +1,175 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MQTTBROKER_LIB_RETAINEDSTORE_H
+#define MQTTBROKER_LIB_RETAINEDSTORE_H
+
+namespace iot::mqtt::server::broker {
+    class Broker;
+}
+
+//
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace mqtt::mqttbroker::lib {
+
+    // Durable store of the retained messages seen by the broker. Every retained publish is appended to a log file, an empty message
+    // appends a tombstone. Next to the log, <path>.index holds the live topics sorted by topic with the offsets of their records. It is
+    // written by each compaction and on close, and is mapped when the store is opened, thus only the records appended behind it are
+    // scanned and nothing but the pages of the topic ranges of the subscriptions is ever read. A corrupt record is skipped up to the
+    // next valid one. The messages are not published to the broker, as that would reach its existing subscribers. Instead, a new
+    // subscription gets the stored messages matching it which the broker does not hold itself, looked up in the topic range of the
+    // subscription's literal prefix and sent in bounded batches across event loop iterations. fdatasync() and the rewriting of the log,
+    // once superseded records make up most of it, run on a background thread.
+    class RetainedStore {
+    private:
+        RetainedStore() = default;
+
+    public:
+        ~RetainedStore();
+
+        RetainedStore(const RetainedStore&) = delete;
+        RetainedStore& operator=(const RetainedStore&) = delete;
+
+        static RetainedStore& instance();
+
+        bool open(const std::string& path);
+        bool isOpen() const;
+        void close();
+
+        // Records a retained publish which has already been handed to the broker
+        void put(std::string_view topic, std::string_view message, uint8_t qoS);
+
+        // Sends the stored messages of all topics matching the subscription of clientId, which the broker does not hold, to that client.
+        // The first batch is sent right away, the others on the next iterations of the event loop.
+        void restore(const std::string& topicFilter, const std::string& clientId, uint8_t qoS, iot::mqtt::server::broker::Broker& broker);
+
+        // Hands the appended records to the background thread for fdatasync() and starts or completes a compaction if needed. Meant to
+        // be called periodically on the event loop.
+        void sync();
+
+    private:
+        struct Entry {
+            uint64_t offset; // of the record, or of the tombstone of a removed topic
+            uint32_t messageLength;
+            uint8_t qoS;
+            bool inBroker; // published to the broker since the store was opened, thus the broker delivers it to new subscriptions
+            bool removed;  // hides the topic of the index file
+        };
+
+        // The entries changed since the index file has been written
+        using Index = std::map<std::string, Entry, std::less<>>;
+
+        // The mapped index file, covering the log up to logSize
+        struct IndexFile {
+            const char* data = nullptr;
+            std::size_t size = 0;
+            uint64_t count = 0;
+            uint64_t logSize = 0;
+            uint64_t liveSize = 0;
+
+            std::string_view topic(uint64_t i) const;
+            Entry entry(uint64_t i) const;
+            uint64_t lowerBound(std::string_view topic) const;
+            bool find(std::string_view topic, Entry& entry) const;
+        };
+
+        // The live records are copied to <path>.compact in topic order on the background thread, which also writes the index file of
+        // the compacted log. Records appended meanwhile are copied behind them when the compaction is completed on the event loop.
+        struct Compaction {
+            std::vector<std::pair<uint64_t, uint64_t>> records;      // offset and size of the live records, in topic order
+            std::vector<std::pair<uint64_t, uint64_t>> offsetMap;    // their offsets in the log and in the compacted log, by offset
+            uint64_t end = 0;                                        // size of the log when the snapshot was taken
+            uint64_t compactSize = 0;
+            int readFd = -1;
+            int compactFd = -1;
+            bool success = false;
+            std::atomic<bool> done = false;
+        };
+
+        struct Restore {
+            std::string topicFilter;
+            std::string prefix; // all matching topics start with it
+            std::string clientId;
+            uint8_t qoS;
+            iot::mqtt::server::broker::Broker* broker;
+            std::string next; // the topic to continue with
+        };
+
+        bool loadIndexFile(uint64_t logInode, uint64_t logSize);
+        void unloadIndexFile();
+        bool writeIndexFile() const;
+
+        bool replay(uint64_t from);
+        void apply(std::string_view topic, uint64_t offset, uint32_t messageLength, uint8_t qoS, bool tombstone, bool inBroker);
+        bool lookup(std::string_view topic, Entry& entry) const;
+
+        // Visits the live topics from topic on in topic order until visit returns false
+        void forEachTopic(std::string_view topic, const std::function<bool(std::string_view, const Entry&)>& visit) const;
+
+        bool append(std::string_view topic, std::string_view message, uint8_t qoS, bool tombstone, uint64_t& offset);
+        bool readMessage(std::string_view topic, const Entry& entry, std::string& message) const;
+
+        void processRestores();
+
+        std::shared_ptr<Compaction> startCompaction() const;
+        static void runCompaction(const std::string& path, Compaction& compaction);
+        void finishCompaction(Compaction& compaction);
+
+        void runInBackground(std::function<void()> task);
+        void stopBackground();
+        void background();
+
+        std::string path;
+        int fd = -1;
+        uint64_t fileSize = 0;
+        uint64_t liveSize = 0;
+        bool dirty = false;
+
+        IndexFile indexFile;
+        Index index;
+
+        std::deque<Restore> restores;
+        bool restoreScheduled = false;
+
+        std::shared_ptr<Compaction> compaction;
+
+        std::thread backgroundThread;
+        std::mutex backgroundMutex;
+        std::condition_variable backgroundCondition;
+        std::deque<std::function<void()>> backgroundTasks;
+        bool backgroundStopped = false;
+    };
+
+} // namespace mqtt::mqttbroker::lib
+
+#endif // MQTTBROKER_LIB_RETAINEDSTORE_H
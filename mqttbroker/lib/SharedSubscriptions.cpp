@@ -0,0 +1,260 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SharedSubscriptions.h"
+
+#include "mqttbroker/lib/TopicFilter.h"
+#include "mqttbroker/lib/WorkerFanout.h"
+
+#include <iot/mqtt/server/broker/Broker.h>
+#include <iot/mqtt/server/broker/Message.h>
+#include <log/Logger.h>
+
+//
+
+#include <algorithm>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+namespace mqtt::mqttbroker::lib {
+
+    SharedSubscriptions& SharedSubscriptions::instance() {
+        static SharedSubscriptions sharedSubscriptions;
+
+        return sharedSubscriptions;
+    }
+
+    bool SharedSubscriptions::isShared(const std::string& topicFilter) {
+        return topicFilter.starts_with("$share/");
+    }
+
+    void SharedSubscriptions::connected(const std::string& clientId, bool cleanSession) {
+        if (cleanSession) {
+            const std::map<std::string, Session>::iterator it = sessions.find(clientId);
+
+            if (it != sessions.end()) {
+                it->second.cleanSession = true;
+                disconnected(clientId);
+            }
+        } else {
+            Session& session = sessions[clientId];
+            session.cleanSession = false;
+
+            for (const auto& [topicFilter, qoS] : session.subscriptions) {
+                sendJoin(topicFilter, clientId, qoS, true);
+            }
+        }
+    }
+
+    void SharedSubscriptions::subscribe(const std::string& clientId, const std::string& topicFilter, uint8_t qoS) {
+        addSubscription(clientId, topicFilter, qoS, true);
+    }
+
+    void SharedSubscriptions::addSubscription(const std::string& clientId, const std::string& topicFilter, uint8_t qoS, bool online) {
+        const std::size_t filterStart = topicFilter.find('/', std::string("$share/").size());
+
+        if (filterStart != std::string::npos && filterStart > std::string("$share/").size()) {
+            sessions[clientId].subscriptions[topicFilter] = qoS;
+
+            sendJoin(topicFilter, clientId, qoS, online);
+        }
+    }
+
+    void SharedSubscriptions::unsubscribe(const std::string& clientId, const std::string& topicFilter) {
+        const std::map<std::string, Session>::iterator it = sessions.find(clientId);
+
+        if (it != sessions.end() && it->second.subscriptions.erase(topicFilter) > 0) {
+            sendLeave(topicFilter, clientId);
+        }
+    }
+
+    void SharedSubscriptions::disconnected(const std::string& clientId) {
+        const std::map<std::string, Session>::iterator it = sessions.find(clientId);
+
+        if (it != sessions.end()) {
+            if (it->second.cleanSession || it->second.subscriptions.empty()) {
+                for (const auto& [topicFilter, qoS] : it->second.subscriptions) {
+                    sendLeave(topicFilter, clientId);
+                }
+
+                sessions.erase(it);
+            } else {
+                for (const auto& [topicFilter, qoS] : it->second.subscriptions) {
+                    sendJoin(topicFilter, clientId, qoS, false);
+                }
+            }
+        }
+    }
+
+    void SharedSubscriptions::takenOver(const std::string& clientId, bool moved) {
+        const std::map<std::string, Session>::iterator it = sessions.find(clientId);
+
+        if (it != sessions.end()) {
+            // A leave could overtake the join of the new worker, the owner takes over the membership on that join instead
+            if (!moved) {
+                for (const auto& [topicFilter, qoS] : it->second.subscriptions) {
+                    sendLeave(topicFilter, clientId);
+                }
+            }
+
+            sessions.erase(it);
+        }
+    }
+
+    void SharedSubscriptions::sendJoin(const std::string& topicFilter, const std::string& clientId, uint8_t qoS, bool online) {
+        WorkerFanout& workerFanout = WorkerFanout::instance();
+        const std::size_t owner = workerFanout.ownerOf(topicFilter);
+
+        if (owner == workerFanout.getWorkerIndex()) {
+            join(owner, topicFilter, clientId, qoS, online);
+        } else {
+            workerFanout.join(owner, topicFilter, clientId, qoS, online);
+        }
+    }
+
+    void SharedSubscriptions::sendLeave(const std::string& topicFilter, const std::string& clientId) {
+        WorkerFanout& workerFanout = WorkerFanout::instance();
+        const std::size_t owner = workerFanout.ownerOf(topicFilter);
+
+        if (owner == workerFanout.getWorkerIndex()) {
+            leave(owner, topicFilter, clientId);
+        } else {
+            workerFanout.leave(owner, topicFilter, clientId);
+        }
+    }
+
+    void SharedSubscriptions::join(
+        std::size_t worker, const std::string& topicFilter, const std::string& clientId, uint8_t qoS, bool online) {
+        WorkerFanout& workerFanout = WorkerFanout::instance();
+
+        const auto [groupIt, created] = groups.try_emplace(topicFilter);
+        Group& group = groupIt->second;
+
+        if (created) {
+            group.topicFilter = topicFilter.substr(topicFilter.find('/', std::string("$share/").size()) + 1);
+
+            if (workerFanout.isActive()) {
+                workerFanout.addTopicFilter(group.topicFilter);
+            }
+        }
+
+        const std::vector<Member>::iterator it =
+            std::find_if(group.members.begin(), group.members.end(), [&clientId](const Member& member) {
+                return member.clientId == clientId;
+            });
+
+        if (it == group.members.end()) {
+            group.members.push_back(Member{clientId, qoS, worker, online});
+        } else if (online || it->worker == worker) {
+            // The disconnect on the previous worker may arrive after the client has connected to another one
+            it->qoS = qoS;
+            it->worker = worker;
+            it->online = online;
+        }
+    }
+
+    void SharedSubscriptions::leave(std::size_t worker, const std::string& topicFilter, const std::string& clientId) {
+        const std::map<std::string, Group>::iterator it = groups.find(topicFilter);
+
+        if (it != groups.end()) {
+            // A membership taken over by a client connected to another worker is kept
+            std::erase_if(it->second.members, [worker, &clientId](const Member& member) {
+                return member.clientId == clientId && member.worker == worker;
+            });
+
+            if (it->second.members.empty()) {
+                WorkerFanout& workerFanout = WorkerFanout::instance();
+                if (workerFanout.isActive()) {
+                    workerFanout.removeTopicFilter(it->second.topicFilter);
+                }
+
+                groups.erase(it);
+            }
+        }
+    }
+
+    void SharedSubscriptions::publish(iot::mqtt::server::broker::Broker& broker,
+                                      const std::string& topic,
+                                      const std::string& message,
+                                      uint8_t qoS) {
+        if (!isShared(topic)) {
+            WorkerFanout& workerFanout = WorkerFanout::instance();
+
+            for (auto& [sharedTopicFilter, group] : groups) {
+                if (matchesTopicFilter(group.topicFilter, topic)) {
+                    const std::size_t memberCount = group.members.size();
+
+                    std::size_t chosen = group.next % memberCount;
+                    for (std::size_t i = 0; i < memberCount; ++i) {
+                        if (group.members[(group.next + i) % memberCount].online) {
+                            chosen = (group.next + i) % memberCount;
+                            break;
+                        }
+                    }
+                    group.next = chosen + 1;
+
+                    const Member& member = group.members[chosen];
+
+                    if (member.worker == workerFanout.getWorkerIndex()) {
+                        iot::mqtt::server::broker::Message sharedMessage(topic, message, qoS, false);
+
+                        broker.sendPublish(member.clientId, sharedMessage, std::min(qoS, member.qoS), false);
+                    } else {
+                        workerFanout.deliver(member.worker, member.clientId, topic, message, std::min(qoS, member.qoS));
+                    }
+                }
+            }
+        }
+    }
+
+    void SharedSubscriptions::loadSessions(const std::string& path) {
+        std::ifstream sessionsFile(path);
+
+        if (sessionsFile.is_open()) {
+            try {
+                const nlohmann::json sessionsJson = nlohmann::json::parse(sessionsFile);
+
+                for (const auto& [clientId, subscriptions] : sessionsJson.items()) {
+                    sessions[clientId].cleanSession = false;
+
+                    for (const auto& [topicFilter, qoS] : subscriptions.items()) {
+                        addSubscription(clientId, topicFilter, qoS.get<uint8_t>(), false);
+                    }
+                }
+            } catch (const nlohmann::json::exception& e) {
+                LOG(ERROR) << "Shared subscriptions " << path << ": " << e.what();
+            }
+        }
+    }
+
+    void SharedSubscriptions::saveSessions(const std::string& path) const {
+        nlohmann::json sessionsJson = nlohmann::json::object();
+
+        for (const auto& [clientId, session] : sessions) {
+            if (!session.cleanSession && !session.subscriptions.empty()) {
+                sessionsJson[clientId] = session.subscriptions;
+            }
+        }
+
+        std::ofstream sessionsFile(path, std::ios::trunc);
+        if (!(sessionsFile << sessionsJson.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace))) {
+            PLOG(ERROR) << "Shared subscriptions " << path;
+        }
+    }
+
+} // namespace mqtt::mqttbroker::lib
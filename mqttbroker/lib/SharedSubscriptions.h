@@ -0,0 +1,102 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MQTTBROKER_LIB_SHAREDSUBSCRIPTIONS_H
+#define MQTTBROKER_LIB_SHAREDSUBSCRIPTIONS_H
+
+namespace iot::mqtt::server::broker {
+    class Broker;
+}
+
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace mqtt::mqttbroker::lib {
+
+    // Shared subscriptions "$share/<group>/<filter>". The broker of snode.c treats such a subscription as a plain topic filter, thus
+    // the members of each group are tracked here by client id and every publish matching the filter of a group is sent to the session
+    // of one member of it, chosen round-robin among the connected members. Only if none is connected it is sent to a disconnected one,
+    // whose session queues QoS 1 and 2 publishes as for any subscription. The memberships of a persistent session stay until the client
+    // connects with a clean session or unsubscribes, they are saved next to the session store. With --workers each group is owned by
+    // one worker, chosen by hashing the shared topic filter, which receives the publishes matching the group and the memberships of the
+    // clients of all workers. It sends each publish to the member's worker for delivery.
+    class SharedSubscriptions {
+    private:
+        SharedSubscriptions() = default;
+
+    public:
+        static SharedSubscriptions& instance();
+
+        static bool isShared(const std::string& topicFilter);
+
+        void connected(const std::string& clientId, bool cleanSession);
+        void subscribe(const std::string& clientId, const std::string& topicFilter, uint8_t qoS);
+        void unsubscribe(const std::string& clientId, const std::string& topicFilter);
+        void disconnected(const std::string& clientId);
+
+        // Forgets the memberships of a session taken over by another worker, which joins them again if the session was moved there
+        void takenOver(const std::string& clientId, bool moved);
+
+        // Called on the owner of the group for the clients of worker. A join updates the membership, online is false for a membership
+        // kept for a disconnected persistent session.
+        void join(std::size_t worker, const std::string& topicFilter, const std::string& clientId, uint8_t qoS, bool online);
+        void leave(std::size_t worker, const std::string& topicFilter, const std::string& clientId);
+
+        // Sends a publish to one member of each matching group
+        void publish(iot::mqtt::server::broker::Broker& broker, const std::string& topic, const std::string& message, uint8_t qoS);
+
+        void loadSessions(const std::string& path);
+        void saveSessions(const std::string& path) const;
+
+    private:
+        struct Member {
+            std::string clientId;
+            uint8_t qoS; // granted
+            std::size_t worker;
+            bool online;
+        };
+
+        struct Group {
+            std::string topicFilter; // without the "$share/<group>/" prefix
+            std::vector<Member> members;
+            std::size_t next = 0;
+        };
+
+        struct Session {
+            bool cleanSession = true;
+            std::map<std::string, uint8_t> subscriptions; // QoS by shared topic filter
+        };
+
+        void addSubscription(const std::string& clientId, const std::string& topicFilter, uint8_t qoS, bool online);
+
+        // Routes a membership change of a local client to the owner of the group
+        void sendJoin(const std::string& topicFilter, const std::string& clientId, uint8_t qoS, bool online);
+        void sendLeave(const std::string& topicFilter, const std::string& clientId);
+
+        std::map<std::string, Group> groups;     // owned by this worker, by the full shared topic filter
+        std::map<std::string, Session> sessions; // by client id
+    };
+
+} // namespace mqtt::mqttbroker::lib
+
+#endif // MQTTBROKER_LIB_SHAREDSUBSCRIPTIONS_H
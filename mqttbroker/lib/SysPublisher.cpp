@@ -0,0 +1,106 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SysPublisher.h"
+
+#include "lib/MqttMetrics.h"
+#include "mqttbroker/lib/MqttModel.h"
+
+#include <iot/mqtt/server/broker/Broker.h>
+
+//
+
+#include <cmath>
+#include <cstddef>
+#include <nlohmann/json.hpp>
+
+namespace mqtt::mqttbroker::lib {
+
+    void SysPublisher::LoadAverage::update(double perMinute, double seconds) {
+        oneMinute = perMinute + (oneMinute - perMinute) * std::exp(-seconds / 60);
+        fiveMinutes = perMinute + (fiveMinutes - perMinute) * std::exp(-seconds / 300);
+        fifteenMinutes = perMinute + (fifteenMinutes - perMinute) * std::exp(-seconds / 900);
+    }
+
+    SysPublisher::SysPublisher(const std::shared_ptr<iot::mqtt::server::broker::Broker>& broker)
+        : broker(broker)
+        , startTime(std::chrono::steady_clock::now())
+        , lastPublishTime(startTime) {
+    }
+
+    void SysPublisher::publish() {
+        const mqtt::lib::MqttMetrics& metrics = mqtt::lib::MqttMetrics::instance();
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(now - lastPublishTime).count();
+
+        const uint64_t publishesReceived = metrics.getPublishesReceived();
+        const uint64_t publishesSent = metrics.getPublishesSent();
+
+        if (seconds > 0) {
+            receivedLoad.update(static_cast<double>(publishesReceived - lastPublishesReceived) * 60 / seconds, seconds);
+            sentLoad.update(static_cast<double>(publishesSent - lastPublishesSent) * 60 / seconds, seconds);
+        }
+
+        lastPublishTime = now;
+        lastPublishesReceived = publishesReceived;
+        lastPublishesSent = publishesSent;
+
+        publish("$SYS/broker/uptime",
+                std::to_string(std::chrono::duration_cast<std::chrono::seconds>(now - startTime).count()) + " seconds");
+        publish("$SYS/broker/clients/connected", std::to_string(MqttModel::instance().getConnectedClientCount()));
+        publish("$SYS/broker/messages/received", std::to_string(publishesReceived));
+        publish("$SYS/broker/messages/sent", std::to_string(publishesSent));
+        publish("$SYS/broker/bytes/received", std::to_string(metrics.getBytesReceived()));
+        publish("$SYS/broker/bytes/sent", std::to_string(metrics.getBytesSent()));
+        publish("$SYS/broker/load/messages/received", receivedLoad);
+        publish("$SYS/broker/load/messages/sent", sentLoad);
+
+        publishLatencies();
+    }
+
+    void SysPublisher::publish(const std::string& topic, const std::string& message) {
+        broker->publish(topic, message, 0, true);
+    }
+
+    void SysPublisher::publish(const std::string& topic, const LoadAverage& loadAverage) {
+        publish(topic + "/1min", std::to_string(loadAverage.oneMinute));
+        publish(topic + "/5min", std::to_string(loadAverage.fiveMinutes));
+        publish(topic + "/15min", std::to_string(loadAverage.fifteenMinutes));
+    }
+
+    // The latency quantiles of each stage of the publish path in microseconds
+    void SysPublisher::publishLatencies() {
+        const mqtt::lib::MqttMetrics& metrics = mqtt::lib::MqttMetrics::instance();
+
+        for (std::size_t index = 0; index < static_cast<std::size_t>(mqtt::lib::MqttMetrics::Stage::Count); ++index) {
+            const mqtt::lib::MqttMetrics::Stage stage = static_cast<mqtt::lib::MqttMetrics::Stage>(index);
+            const mqtt::lib::LatencyHistogram& latency = metrics.latency(stage);
+
+            const nlohmann::json latencyJson = {
+                {"count", latency.getCount()},
+                {"p50_us", std::chrono::duration_cast<std::chrono::microseconds>(latency.getQuantile(0.5)).count()},
+                {"p90_us", std::chrono::duration_cast<std::chrono::microseconds>(latency.getQuantile(0.9)).count()},
+                {"p99_us", std::chrono::duration_cast<std::chrono::microseconds>(latency.getQuantile(0.99)).count()},
+                {"max_us", std::chrono::duration_cast<std::chrono::microseconds>(latency.getMax()).count()}};
+
+            publish(std::string("$SYS/broker/latency/") + mqtt::lib::MqttMetrics::stageName(stage), latencyJson.dump());
+        }
+    }
+
+} // namespace mqtt::mqttbroker::lib
@@ -0,0 +1,71 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MQTTBROKER_LIB_SYSPUBLISHER_H
+#define MQTTBROKER_LIB_SYSPUBLISHER_H
+
+namespace iot::mqtt::server::broker {
+    class Broker;
+}
+
+//
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace mqtt::mqttbroker::lib {
+
+    // Publishes the broker statistics as retained messages to the $SYS/broker/... topics known from other brokers. publish() is
+    // meant to be called by an interval timer, the load averages are the messages per minute averaged exponentially over 1, 5 and
+    // 15 minutes.
+    class SysPublisher {
+    public:
+        explicit SysPublisher(const std::shared_ptr<iot::mqtt::server::broker::Broker>& broker);
+
+        void publish();
+
+    private:
+        struct LoadAverage {
+            void update(double perMinute, double seconds);
+
+            double oneMinute = 0;
+            double fiveMinutes = 0;
+            double fifteenMinutes = 0;
+        };
+
+        void publish(const std::string& topic, const std::string& message);
+        void publish(const std::string& topic, const LoadAverage& loadAverage);
+        void publishLatencies();
+
+        std::shared_ptr<iot::mqtt::server::broker::Broker> broker;
+
+        std::chrono::steady_clock::time_point startTime;
+        std::chrono::steady_clock::time_point lastPublishTime;
+
+        uint64_t lastPublishesReceived = 0;
+        uint64_t lastPublishesSent = 0;
+
+        LoadAverage receivedLoad;
+        LoadAverage sentLoad;
+    };
+
+} // namespace mqtt::mqttbroker::lib
+
+#endif // MQTTBROKER_LIB_SYSPUBLISHER_H
@@ -0,0 +1,65 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TopicFilter.h"
+
+//
+
+#include <string_view>
+
+namespace mqtt::mqttbroker::lib {
+
+    bool matchesTopicFilter(std::string_view topicFilter, std::string_view topic) {
+        bool match = false;
+
+        if (!(topic.starts_with('$') && (topicFilter.starts_with('+') || topicFilter.starts_with('#')))) {
+            std::string_view filterLevels(topicFilter);
+            std::string_view topicLevels(topic);
+
+            for (;;) {
+                const std::size_t filterSlash = filterLevels.find('/');
+                const std::string_view filterLevel = filterLevels.substr(0, filterSlash);
+
+                if (filterLevel == "#") {
+                    match = true;
+                    break;
+                }
+
+                const std::size_t topicSlash = topicLevels.find('/');
+                const std::string_view topicLevel = topicLevels.substr(0, topicSlash);
+
+                if (filterLevel != "+" && filterLevel != topicLevel) {
+                    break;
+                }
+
+                if (filterSlash == std::string_view::npos || topicSlash == std::string_view::npos) {
+                    // "a/#" matches "a" as well
+                    match = (filterSlash == std::string_view::npos && topicSlash == std::string_view::npos) ||
+                            (topicSlash == std::string_view::npos && filterLevels.substr(filterSlash + 1) == "#");
+                    break;
+                }
+
+                filterLevels.remove_prefix(filterSlash + 1);
+                topicLevels.remove_prefix(topicSlash + 1);
+            }
+        }
+
+        return match;
+    }
+
+} // namespace mqtt::mqttbroker::lib
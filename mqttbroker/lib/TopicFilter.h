@@ -0,0 +1,32 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MQTTBROKER_LIB_TOPICFILTER_H
+#define MQTTBROKER_LIB_TOPICFILTER_H
+
+#include <string_view>
+
+namespace mqtt::mqttbroker::lib {
+
+    // Whether topic matches topicFilter with the '+' and '#' wildcards. Topics starting with '$' are not matched by a wildcard in the
+    // first level.
+    bool matchesTopicFilter(std::string_view topicFilter, std::string_view topic);
+
+} // namespace mqtt::mqttbroker::lib
+
+#endif // MQTTBROKER_LIB_TOPICFILTER_H
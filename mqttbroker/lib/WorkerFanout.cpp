@@ -0,0 +1,765 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WorkerFanout.h"
+
+#include "mqttbroker/lib/Mqtt.h"
+#include "mqttbroker/lib/MqttModel.h"
+#include "mqttbroker/lib/RetainedStore.h"
+#include "mqttbroker/lib/SharedSubscriptions.h"
+#include "mqttbroker/lib/TopicFilter.h"
+
+#include <core/eventreceiver/ReadEventReceiver.h>
+#include <iot/mqtt/server/broker/Broker.h>
+#include <iot/mqtt/server/broker/Message.h>
+#include <log/Logger.h>
+
+//
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace mqtt::mqttbroker::lib {
+
+    struct WorkerFanout::Ring {
+        static constexpr std::size_t capacity = std::size_t{1} << 20;
+
+        // A fragment is its header followed by length bytes of the record, written contiguously modulo capacity
+        struct Header {
+            uint32_t length;
+            uint8_t type;
+            uint8_t qoS;
+            uint8_t retain;
+            uint8_t more; // further fragments of the record follow
+        };
+
+        static constexpr std::size_t maxFragment = capacity / 4 - sizeof(Header);
+
+        std::size_t space() const {
+            return capacity - static_cast<std::size_t>(head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+        }
+
+        void copyIn(uint64_t position, const void* source, std::size_t length) {
+            const std::size_t offset = position % capacity;
+            const std::size_t first = std::min(length, capacity - offset);
+
+            std::memcpy(data + offset, source, first);
+            std::memcpy(data, static_cast<const char*>(source) + first, length - first);
+        }
+
+        void copyOut(uint64_t position, void* destination, std::size_t length) const {
+            const std::size_t offset = position % capacity;
+            const std::size_t first = std::min(length, capacity - offset);
+
+            std::memcpy(destination, data + offset, first);
+            std::memcpy(static_cast<char*>(destination) + first, data, length - first);
+        }
+
+        alignas(64) std::atomic<uint64_t> head = 0; // written by the producer
+        alignas(64) std::atomic<uint64_t> tail = 0; // written by the consumer
+        std::atomic<bool> spilled = false;          // the producer waits for space, the consumer wakes it after advancing the tail
+        alignas(64) char data[capacity];
+    };
+
+    // Placed behind the rings
+    struct WorkerFanout::WorkerState {
+        alignas(64) std::atomic<bool> signaled = false; // the eventfd has been signaled and the worker has not woken up since
+        std::atomic<bool> exited = false;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring positions are shared between processes");
+    static_assert(std::atomic<bool>::is_always_lock_free, "worker states are shared between processes");
+
+    // Calls onEvent of the worker fan-out whenever fd is readable
+    class WorkerFanout::EventReceiver : public core::eventreceiver::ReadEventReceiver {
+    public:
+        EventReceiver(const std::string& name, WorkerFanout& workerFanout, void (WorkerFanout::*onEvent)(), int fd)
+            : core::eventreceiver::ReadEventReceiver(name, core::DescriptorEventReceiver::TIMEOUT::DISABLE)
+            , workerFanout(workerFanout)
+            , onEvent(onEvent) {
+            enable(fd);
+        }
+
+    private:
+        void readEvent() final {
+            (workerFanout.*onEvent)();
+        }
+
+        void unobservedEvent() final {
+            delete this;
+        }
+
+        WorkerFanout& workerFanout;
+        void (WorkerFanout::*onEvent)();
+    };
+
+    // Reads the next length prefixed field of a record
+    static std::string_view nextField(std::string_view& record) {
+        uint32_t length = 0;
+
+        if (record.size() >= sizeof(length)) {
+            std::memcpy(&length, record.data(), sizeof(length));
+            record.remove_prefix(sizeof(length));
+        }
+
+        const std::string_view field = record.substr(0, length);
+        record.remove_prefix(field.size());
+
+        return field;
+    }
+
+    WorkerFanout::~WorkerFanout() {
+        if (memory != nullptr) {
+            munmap(memory, memorySize);
+        }
+
+        for (const int eventFd : eventFds) {
+            close(eventFd);
+        }
+        if (signalFd >= 0) {
+            close(signalFd);
+        }
+    }
+
+    WorkerFanout& WorkerFanout::instance() {
+        static WorkerFanout workerFanout;
+
+        return workerFanout;
+    }
+
+    bool WorkerFanout::create(std::size_t workerCount) {
+        if (memory == nullptr && workerCount > 1) {
+            const std::size_t ringCount = workerCount * workerCount;
+
+            for (std::size_t i = 0; i < workerCount && eventFds.size() == i; ++i) {
+                const int eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+                if (eventFd >= 0) {
+                    eventFds.push_back(eventFd);
+                } else {
+                    PLOG(ERROR) << "eventfd of worker " << i;
+                }
+            }
+
+            memorySize = ringCount * sizeof(Ring) + workerCount * sizeof(WorkerState);
+            memory = eventFds.size() == workerCount
+                         ? mmap(nullptr, memorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)
+                         : MAP_FAILED;
+
+            if (memory != MAP_FAILED) {
+                for (std::size_t i = 0; i < ringCount; ++i) {
+                    new (static_cast<Ring*>(memory) + i) Ring();
+                }
+                for (std::size_t i = 0; i < workerCount; ++i) {
+                    new (reinterpret_cast<WorkerState*>(static_cast<Ring*>(memory) + ringCount) + i) WorkerState();
+                }
+
+                this->workerCount = workerCount;
+            } else {
+                if (eventFds.size() == workerCount) {
+                    PLOG(ERROR) << "mmap worker rings";
+                }
+
+                for (const int eventFd : eventFds) {
+                    close(eventFd);
+                }
+                eventFds.clear();
+
+                memory = nullptr;
+                memorySize = 0;
+            }
+        }
+
+        return memory != nullptr;
+    }
+
+    void WorkerFanout::attach(std::size_t workerIndex,
+                              const std::vector<pid_t>& workerPids,
+                              const std::shared_ptr<iot::mqtt::server::broker::Broker>& broker) {
+        this->workerIndex = workerIndex;
+        this->workerPids = workerPids;
+        this->broker = broker;
+
+        overflows = std::vector<Overflow>(workerCount);
+        fragmented = std::vector<std::string>(workerCount);
+        remoteFilters = std::vector<RemoteFilters>(workerCount);
+
+        if (isActive()) {
+            new EventReceiver("WorkerFanout", *this, &WorkerFanout::wokenUp, eventFds[workerIndex]);
+
+            // Workers which could not be forked
+            for (std::size_t worker = workerPids.size() + 1; workerIndex == 0 && worker < workerCount; ++worker) {
+                state(worker).exited.store(true, std::memory_order_release);
+            }
+
+            if (!workerPids.empty()) {
+                // Blocked before any thread is started, thus SIGCHLD is only ever consumed from the signalfd
+                sigset_t sigChld;
+                sigemptyset(&sigChld);
+                sigaddset(&sigChld, SIGCHLD);
+
+                if (pthread_sigmask(SIG_BLOCK, &sigChld, nullptr) == 0 &&
+                    (signalFd = signalfd(-1, &sigChld, SFD_NONBLOCK | SFD_CLOEXEC)) >= 0) {
+                    new EventReceiver("WorkerFanoutReaper", *this, &WorkerFanout::reap, signalFd);
+                } else {
+                    PLOG(ERROR) << "signalfd SIGCHLD";
+                }
+
+                // A worker may have exited before SIGCHLD was blocked
+                reap();
+            }
+
+            // Records written before the event receiver existed
+            wake(workerIndex);
+        }
+    }
+
+    bool WorkerFanout::isActive() const {
+        return memory != nullptr;
+    }
+
+    WorkerFanout::Ring& WorkerFanout::ring(std::size_t from, std::size_t to) const {
+        return static_cast<Ring*>(memory)[from * workerCount + to];
+    }
+
+    WorkerFanout::WorkerState& WorkerFanout::state(std::size_t worker) const {
+        return reinterpret_cast<WorkerState*>(static_cast<Ring*>(memory) + workerCount * workerCount)[worker];
+    }
+
+    void WorkerFanout::wake(std::size_t worker) {
+        if (!state(worker).signaled.exchange(true, std::memory_order_acq_rel)) {
+            const uint64_t one = 1;
+
+            if (write(eventFds[worker], &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                PLOG(ERROR) << "write eventfd of worker " << worker;
+            }
+        }
+    }
+
+    void WorkerFanout::wokenUp() {
+        uint64_t signaled = 0;
+
+        if (read(eventFds[workerIndex], &signaled, sizeof(signaled)) == sizeof(signaled)) {
+            // Records written after this are signaled again
+            state(workerIndex).signaled.exchange(false, std::memory_order_acq_rel);
+
+            receive(*broker);
+        }
+    }
+
+    void WorkerFanout::reap() {
+        signalfd_siginfo signalInfo{};
+        while (signalFd >= 0 && read(signalFd, &signalInfo, sizeof(signalInfo)) == sizeof(signalInfo)) {
+        }
+
+        for (std::size_t worker = 1; worker < workerCount && worker <= workerPids.size(); ++worker) {
+            int status = 0;
+
+            if (!state(worker).exited.load(std::memory_order_acquire) && waitpid(workerPids[worker - 1], &status, WNOHANG) > 0) {
+                state(worker).exited.store(true, std::memory_order_release);
+
+                if (WIFSIGNALED(status)) {
+                    LOG(ERROR) << "Worker " << worker << " (pid " << workerPids[worker - 1] << ") killed by signal " << WTERMSIG(status);
+                } else {
+                    LOG(ERROR) << "Worker " << worker << " (pid " << workerPids[worker - 1] << ") exited with " << WEXITSTATUS(status);
+                }
+
+                // All workers drop what they hold for it
+                for (std::size_t other = 0; other < workerCount; ++other) {
+                    if (other != worker) {
+                        wake(other);
+                    }
+                }
+            }
+        }
+    }
+
+    bool WorkerFanout::RemoteFilters::matches(std::string_view topic) const {
+        return literal.contains(topic) || std::any_of(wildcard.begin(), wildcard.end(), [topic](const std::string& topicFilter) {
+                   return matchesTopicFilter(topicFilter, topic);
+               });
+    }
+
+    void WorkerFanout::forward(std::string_view topic, std::string_view message, uint8_t qoS, bool retain) {
+        for (std::size_t to = 0; to < workerCount; ++to) {
+            if (to != workerIndex && (retain || remoteFilters[to].matches(topic))) {
+                send(to, Type::Publish, qoS, retain, {topic, message});
+            }
+        }
+    }
+
+    void WorkerFanout::connected(const std::string& clientId, bool cleanSession) {
+        if (cleanSession) {
+            disconnected(clientId, true);
+        } else {
+            sessions[clientId].cleanSession = false;
+        }
+
+        const int64_t connectTime = std::chrono::system_clock::now().time_since_epoch().count();
+        const uint8_t cleanSessionFlag = cleanSession ? 1 : 0;
+
+        broadcast(Type::ClientConnected,
+                  {clientId,
+                   std::string_view(reinterpret_cast<const char*>(&connectTime), sizeof(connectTime)),
+                   std::string_view(reinterpret_cast<const char*>(&cleanSessionFlag), sizeof(cleanSessionFlag))});
+    }
+
+    void WorkerFanout::subscribe(const std::string& clientId, const std::string& topicFilter, uint8_t qoS) {
+        // The worker owning a shared subscription's group receives its publishes
+        if (sessions[clientId].subscriptions.insert_or_assign(topicFilter, qoS).second && !SharedSubscriptions::isShared(topicFilter)) {
+            addTopicFilter(topicFilter);
+        }
+    }
+
+    void WorkerFanout::unsubscribe(const std::string& clientId, const std::string& topicFilter) {
+        const auto it = sessions.find(clientId);
+
+        if (it != sessions.end() && it->second.subscriptions.erase(topicFilter) > 0) {
+            if (!SharedSubscriptions::isShared(topicFilter)) {
+                removeTopicFilter(topicFilter);
+            }
+
+            if (it->second.cleanSession && it->second.subscriptions.empty()) {
+                sessions.erase(it);
+            }
+        }
+    }
+
+    void WorkerFanout::disconnected(const std::string& clientId, bool cleanSession) {
+        const auto it = cleanSession ? sessions.find(clientId) : sessions.end();
+
+        if (it != sessions.end()) {
+            for (const auto& [topicFilter, qoS] : it->second.subscriptions) {
+                if (!SharedSubscriptions::isShared(topicFilter)) {
+                    removeTopicFilter(topicFilter);
+                }
+            }
+            sessions.erase(it);
+        }
+    }
+
+    void WorkerFanout::loadSessions(const std::string& path) {
+        std::ifstream sessionsFile(path);
+
+        if (sessionsFile.is_open()) {
+            try {
+                const nlohmann::json sessionsJson = nlohmann::json::parse(sessionsFile);
+
+                for (const auto& [clientId, subscriptions] : sessionsJson.items()) {
+                    sessions[clientId].cleanSession = false;
+
+                    for (const auto& [topicFilter, qoS] : subscriptions.items()) {
+                        subscribe(clientId, topicFilter, qoS.get<uint8_t>());
+                    }
+                }
+            } catch (const nlohmann::json::exception& e) {
+                LOG(ERROR) << "Worker sessions " << path << ": " << e.what();
+            }
+        }
+    }
+
+    void WorkerFanout::saveSessions(const std::string& path) const {
+        nlohmann::json sessionsJson = nlohmann::json::object();
+
+        for (const auto& [clientId, session] : sessions) {
+            if (!session.cleanSession && !session.subscriptions.empty()) {
+                sessionsJson[clientId] = session.subscriptions;
+            }
+        }
+
+        std::ofstream sessionsFile(path, std::ios::trunc);
+        if (!(sessionsFile << sessionsJson.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace))) {
+            PLOG(ERROR) << "Worker sessions " << path;
+        }
+    }
+
+    std::size_t WorkerFanout::getWorkerIndex() const {
+        return workerIndex;
+    }
+
+    std::size_t WorkerFanout::ownerOf(const std::string& sharedTopicFilter) const {
+        return isActive() ? std::hash<std::string>{}(sharedTopicFilter) % workerCount : workerIndex;
+    }
+
+    void WorkerFanout::join(
+        std::size_t owner, const std::string& sharedTopicFilter, const std::string& clientId, uint8_t qoS, bool online) {
+        const uint8_t onlineFlag = online ? 1 : 0;
+
+        send(owner,
+             Type::SharedJoin,
+             qoS,
+             false,
+             {sharedTopicFilter, clientId, std::string_view(reinterpret_cast<const char*>(&onlineFlag), sizeof(onlineFlag))});
+    }
+
+    void WorkerFanout::leave(std::size_t owner, const std::string& sharedTopicFilter, const std::string& clientId) {
+        send(owner, Type::SharedLeave, 0, false, {sharedTopicFilter, clientId});
+    }
+
+    void WorkerFanout::deliver(std::size_t worker,
+                               const std::string& clientId,
+                               const std::string& topic,
+                               const std::string& message,
+                               uint8_t qoS) {
+        send(worker, Type::SharedDeliver, qoS, false, {clientId, topic, message});
+    }
+
+    void WorkerFanout::addTopicFilter(const std::string& topicFilter) {
+        if (topicFilterCounts[topicFilter]++ == 0) {
+            broadcast(Type::Subscribe, {topicFilter});
+        }
+    }
+
+    void WorkerFanout::removeTopicFilter(const std::string& topicFilter) {
+        const auto it = topicFilterCounts.find(topicFilter);
+
+        if (it != topicFilterCounts.end() && --it->second == 0) {
+            topicFilterCounts.erase(it);
+            broadcast(Type::Unsubscribe, {topicFilter});
+        }
+    }
+
+    void WorkerFanout::broadcast(Type type, std::initializer_list<std::string_view> fields) {
+        for (std::size_t to = 0; to < workerCount; ++to) {
+            if (to != workerIndex) {
+                send(to, type, 0, false, fields);
+            }
+        }
+    }
+
+    void WorkerFanout::takeOver(std::size_t from,
+                                const std::string& clientId,
+                                int64_t connectTime,
+                                bool cleanSession,
+                                iot::mqtt::server::broker::Broker& broker) {
+        const ConnectedClient* connectedClient = MqttModel::instance().getConnectedClientByClientId(clientId);
+
+        // Of two connections racing each other the later one wins on both workers
+        if (connectedClient == nullptr || connectedClient->connectTime.time_since_epoch().count() <= connectTime) {
+            if (connectedClient != nullptr) {
+                VLOG(0) << "Client " << clientId << " connected to worker " << from << ": taking over its session";
+
+                connectedClient->mqtt->takenOver();
+            }
+
+            const auto it = sessions.find(clientId);
+            if (it != sessions.end()) {
+                // The subscriptions of a clean session end with its connection
+                const bool moveSession = !cleanSession && !it->second.cleanSession;
+                std::string subscriptions;
+
+                for (const auto& [topicFilter, qoS] : it->second.subscriptions) {
+                    broker.unsubscribe(clientId, topicFilter);
+                    if (!SharedSubscriptions::isShared(topicFilter)) {
+                        removeTopicFilter(topicFilter);
+                    }
+
+                    if (moveSession) {
+                        const uint32_t length = static_cast<uint32_t>(topicFilter.size());
+                        subscriptions.append(reinterpret_cast<const char*>(&length), sizeof(length)).append(topicFilter).push_back(
+                            static_cast<char>(qoS));
+                    }
+                }
+                sessions.erase(it);
+
+                SharedSubscriptions::instance().takenOver(clientId, moveSession);
+
+                if (!subscriptions.empty()) {
+                    send(from, Type::Subscriptions, 0, false, {clientId, subscriptions});
+                }
+            }
+        }
+    }
+
+    void WorkerFanout::send(std::size_t to, Type type, uint8_t qoS, bool retain, std::initializer_list<std::string_view> fields) {
+        Overflow& overflow = overflows[to];
+
+        if (state(to).exited.load(std::memory_order_acquire)) {
+            overflow = Overflow();
+        } else if (type == Type::Publish && qoS == 0 && overflow.bytes >= maxQoS0OverflowBytes) {
+            if (dropped++ % 1000 == 0) {
+                LOG(WARNING) << "Worker " << to << " is not keeping up: " << dropped << " QoS 0 publishes not forwarded";
+            }
+        } else if (overflow.bytes >= maxOverflowBytes) {
+            // Dropped as a whole, thus the records passed on later are still complete
+            if (dropped++ % 1000 == 0) {
+                LOG(ERROR) << "Worker " << to << " is stalled: " << dropped << " records not forwarded";
+            }
+        } else {
+            std::array<uint32_t, maxFields> lengths{};
+            std::array<std::string_view, 2 * maxFields> pieces{};
+
+            std::size_t remaining = 0;
+            for (std::size_t i = 0; const std::string_view field : fields) {
+                lengths[i] = static_cast<uint32_t>(field.size());
+                pieces[2 * i] = std::string_view(reinterpret_cast<const char*>(&lengths[i]), sizeof(uint32_t));
+                pieces[2 * i + 1] = field;
+
+                remaining += sizeof(uint32_t) + field.size();
+                ++i;
+            }
+
+            Ring& outRing = ring(workerIndex, to);
+            uint64_t head = outRing.head.load(std::memory_order_relaxed);
+
+            std::size_t piece = 0;
+            std::size_t pieceOffset = 0;
+
+            bool written = false;
+
+            // Copies the next length bytes of the pieces to sink
+            const auto copyPieces = [&pieces, &piece, &pieceOffset](std::size_t length, const auto& sink) -> void {
+                while (length > 0) {
+                    const std::size_t chunk = std::min(length, pieces[piece].size() - pieceOffset);
+
+                    sink(pieces[piece].data() + pieceOffset, chunk);
+                    length -= chunk;
+                    pieceOffset += chunk;
+
+                    if (pieceOffset == pieces[piece].size()) {
+                        ++piece;
+                        pieceOffset = 0;
+                    }
+                }
+            };
+
+            while (remaining > 0) {
+                const std::size_t length = std::min(remaining, Ring::maxFragment);
+                remaining -= length;
+
+                const Ring::Header header{static_cast<uint32_t>(length),
+                                          static_cast<uint8_t>(type),
+                                          qoS,
+                                          static_cast<uint8_t>(retain ? 1 : 0),
+                                          static_cast<uint8_t>(remaining > 0 ? 1 : 0)};
+
+                if (overflow.fragments.empty() && outRing.space() >= sizeof(header) + length) {
+                    outRing.copyIn(head, &header, sizeof(header));
+                    head += sizeof(header);
+
+                    copyPieces(length, [&outRing, &head](const char* data, std::size_t size) -> void {
+                        outRing.copyIn(head, data, size);
+                        head += size;
+                    });
+
+                    outRing.head.store(head, std::memory_order_release);
+                    written = true;
+                } else {
+                    std::string& fragment = overflow.fragments.emplace_back(reinterpret_cast<const char*>(&header), sizeof(header));
+                    fragment.reserve(sizeof(header) + length);
+
+                    copyPieces(length, [&fragment](const char* data, std::size_t size) -> void {
+                        fragment.append(data, size);
+                    });
+
+                    overflow.bytes += fragment.size();
+                }
+            }
+
+            if (written) {
+                wake(to);
+            }
+            if (!overflow.fragments.empty()) {
+                flush(to);
+            }
+        }
+    }
+
+    void WorkerFanout::flush(std::size_t to) {
+        Overflow& overflow = overflows[to];
+
+        if (state(to).exited.load(std::memory_order_acquire)) {
+            overflow = Overflow();
+        } else if (!overflow.fragments.empty()) {
+            Ring& outRing = ring(workerIndex, to);
+            uint64_t head = outRing.head.load(std::memory_order_relaxed);
+            const uint64_t flushedHead = head;
+
+            // Marked before the space is checked, thus space freed after the check wakes this worker
+            outRing.spilled.exchange(true, std::memory_order_acq_rel);
+
+            while (!overflow.fragments.empty() && outRing.space() >= overflow.fragments.front().size()) {
+                const std::string& fragment = overflow.fragments.front();
+
+                outRing.copyIn(head, fragment.data(), fragment.size());
+                head += fragment.size();
+                outRing.head.store(head, std::memory_order_release);
+
+                overflow.bytes -= fragment.size();
+                overflow.fragments.pop_front();
+            }
+
+            if (head != flushedHead) {
+                wake(to);
+            }
+        }
+    }
+
+    std::size_t WorkerFanout::receive(iot::mqtt::server::broker::Broker& broker) {
+        std::size_t count = 0;
+
+        for (std::size_t worker = 0; worker < workerCount; ++worker) {
+            if (worker != workerIndex) {
+                flush(worker);
+            }
+        }
+
+        for (std::size_t from = 0; from < workerCount; ++from) {
+            if (from != workerIndex && state(from).exited.load(std::memory_order_acquire)) {
+                // Its last record may be incomplete and its subscriptions are gone
+                fragmented[from].clear();
+                remoteFilters[from] = RemoteFilters();
+            } else if (from != workerIndex) {
+                Ring& inRing = ring(from, workerIndex);
+                std::string& record = fragmented[from];
+
+                uint64_t tail = inRing.tail.load(std::memory_order_relaxed);
+                const uint64_t head = inRing.head.load(std::memory_order_acquire);
+                const uint64_t receivedTail = tail;
+
+                while (tail != head) {
+                    Ring::Header header{};
+                    inRing.copyOut(tail, &header, sizeof(header));
+
+                    const std::size_t recordOffset = record.size();
+                    record.resize(recordOffset + header.length);
+                    inRing.copyOut(tail + sizeof(header), record.data() + recordOffset, header.length);
+
+                    tail += sizeof(header) + header.length;
+                    inRing.tail.store(tail, std::memory_order_release);
+
+                    if (header.more == 0) {
+                        process(from, static_cast<Type>(header.type), header.qoS, header.retain != 0, record, broker);
+                        record.clear();
+                        ++count;
+                    }
+                }
+
+                if (tail != receivedTail && inRing.spilled.exchange(false, std::memory_order_acq_rel)) {
+                    wake(from);
+                }
+            }
+        }
+
+        return count;
+    }
+
+    void WorkerFanout::process(std::size_t from,
+                               Type type,
+                               uint8_t qoS,
+                               bool retain,
+                               std::string_view record,
+                               iot::mqtt::server::broker::Broker& broker) {
+        switch (type) {
+            case Type::Publish: {
+                const std::string topic(nextField(record));
+                const std::string message(nextField(record));
+
+                broker.publish(topic, message, qoS, retain);
+                if (retain) {
+                    RetainedStore::instance().put(topic, message, qoS);
+                }
+                SharedSubscriptions::instance().publish(broker, topic, message, qoS);
+                break;
+            }
+            case Type::Subscribe:
+            case Type::Unsubscribe: {
+                const std::string_view topicFilter = nextField(record);
+
+                RemoteFilters& filters = remoteFilters[from];
+                std::set<std::string, std::less<>>& topicFilters =
+                    topicFilter.find_first_of("+#") == std::string_view::npos ? filters.literal : filters.wildcard;
+
+                if (type == Type::Subscribe) {
+                    topicFilters.emplace(topicFilter);
+                } else if (const auto it = topicFilters.find(topicFilter); it != topicFilters.end()) {
+                    topicFilters.erase(it);
+                }
+                break;
+            }
+            case Type::SharedJoin: {
+                const std::string sharedTopicFilter(nextField(record));
+                const std::string clientId(nextField(record));
+                const std::string_view onlineField = nextField(record);
+
+                SharedSubscriptions::instance().join(from, sharedTopicFilter, clientId, qoS, !onlineField.empty() && onlineField[0] != 0);
+                break;
+            }
+            case Type::SharedLeave: {
+                const std::string sharedTopicFilter(nextField(record));
+                const std::string clientId(nextField(record));
+
+                SharedSubscriptions::instance().leave(from, sharedTopicFilter, clientId);
+                break;
+            }
+            case Type::SharedDeliver: {
+                const std::string clientId(nextField(record));
+                const std::string topic(nextField(record));
+                const std::string message(nextField(record));
+
+                iot::mqtt::server::broker::Message sharedMessage(topic, message, qoS, false);
+                broker.sendPublish(clientId, sharedMessage, qoS, false);
+                break;
+            }
+            case Type::ClientConnected: {
+                const std::string clientId(nextField(record));
+
+                int64_t connectTime = 0;
+                const std::string_view connectTimeField = nextField(record);
+                std::memcpy(&connectTime, connectTimeField.data(), std::min(connectTimeField.size(), sizeof(connectTime)));
+
+                const std::string_view cleanSessionField = nextField(record);
+
+                takeOver(from, clientId, connectTime, !cleanSessionField.empty() && cleanSessionField[0] != 0, broker);
+                break;
+            }
+            case Type::Subscriptions: {
+                const std::string clientId(nextField(record));
+                std::string_view subscriptions = nextField(record);
+
+                while (!subscriptions.empty()) {
+                    const std::string topicFilter(nextField(subscriptions));
+                    const uint8_t subscriptionQoS = subscriptions.empty() ? 0 : static_cast<uint8_t>(subscriptions[0]);
+                    subscriptions.remove_prefix(std::min<std::size_t>(subscriptions.size(), 1));
+
+                    broker.subscribe(clientId, topicFilter, subscriptionQoS);
+                    subscribe(clientId, topicFilter, subscriptionQoS);
+                    if (SharedSubscriptions::isShared(topicFilter)) {
+                        SharedSubscriptions::instance().subscribe(clientId, topicFilter, subscriptionQoS);
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+} // namespace mqtt::mqttbroker::lib
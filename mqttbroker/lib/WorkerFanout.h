@@ -0,0 +1,202 @@
+/*
+ * snode.c - a slim toolkit for network communication
+ * Copyright (C) 2020, 2021, 2022, 2023 Volker Christian <me@vchrist.at>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MQTTBROKER_LIB_WORKERFANOUT_H
+#define MQTTBROKER_LIB_WORKERFANOUT_H
+
+namespace iot::mqtt::server::broker {
+    class Broker;
+}
+
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+namespace mqtt::mqttbroker::lib {
+
+    // Propagation of publishes between the processes of a broker started with --workers. Every ordered pair of workers is connected by
+    // a single-producer single-consumer ring buffer in shared memory created before forking. Each worker tells the others about the
+    // topic filters its clients subscribe to first and unsubscribe from last. A worker forwards the publishes received from its clients
+    // and its mapped publishes to the workers with a matching topic filter, which hand them to their local broker. Retained publishes
+    // are forwarded to all workers, so that the retained messages of every worker are complete.
+    //
+    // A client connecting to a worker takes over a connection with its client id on another worker, which is closed. The subscriptions
+    // of its persistent session are moved to the new worker, but the messages queued for the session by the old worker are lost. The
+    // subscriptions of the persistent sessions are saved next to the session store of each worker, to be propagated again on restart.
+    //
+    // Records are written in fragments of at most a quarter of a ring, thus a record of any size is passed on. A worker is woken by its
+    // eventfd once records are written to one of its rings. Fragments not fitting into the ring of a worker which is not keeping up are
+    // spilled into an overflow queue of the sending worker, which is woken to move them into the ring as space frees up. Beyond
+    // maxQoS0OverflowBytes per worker QoS 0 publishes are dropped, beyond maxOverflowBytes all records are.
+    //
+    // The initial worker reaps the others. Nothing is sent to a worker which has exited anymore, its clients reconnect to the others.
+    class WorkerFanout {
+    private:
+        WorkerFanout() = default;
+
+    public:
+        static constexpr std::size_t maxQoS0OverflowBytes = std::size_t{64} << 20;
+        static constexpr std::size_t maxOverflowBytes = std::size_t{256} << 20;
+
+        ~WorkerFanout();
+
+        WorkerFanout(const WorkerFanout&) = delete;
+        WorkerFanout& operator=(const WorkerFanout&) = delete;
+
+        static WorkerFanout& instance();
+
+        // Maps the ring buffers and creates the eventfds of the workers, must be called before forking the workers
+        bool create(std::size_t workerCount);
+
+        // Selects the rings of this process and starts receiving from them, must be called in every worker after core::SNodeC::init().
+        // workerPids are the pids of the other workers, known by the initial worker only, which reaps them.
+        void attach(std::size_t workerIndex,
+                    const std::vector<pid_t>& workerPids,
+                    const std::shared_ptr<iot::mqtt::server::broker::Broker>& broker);
+
+        bool isActive() const;
+
+        void forward(std::string_view topic, std::string_view message, uint8_t qoS, bool retain);
+
+        // Track the subscriptions of the local clients. Those of a persistent session stay until the client connects with a clean
+        // session or unsubscribes or until the session is taken over by another worker.
+        void connected(const std::string& clientId, bool cleanSession);
+        void subscribe(const std::string& clientId, const std::string& topicFilter, uint8_t qoS);
+        void unsubscribe(const std::string& clientId, const std::string& topicFilter);
+        void disconnected(const std::string& clientId, bool cleanSession);
+
+        std::size_t getWorkerIndex() const;
+
+        // The groups of shared subscriptions are distributed over the workers, the owner of a group tracks all its members and delivers
+        // each publish matching the group to one of them, on the member's worker
+        std::size_t ownerOf(const std::string& sharedTopicFilter) const;
+        void join(std::size_t owner, const std::string& sharedTopicFilter, const std::string& clientId, uint8_t qoS, bool online);
+        void leave(std::size_t owner, const std::string& sharedTopicFilter, const std::string& clientId);
+        void deliver(std::size_t worker, const std::string& clientId, const std::string& topic, const std::string& message, uint8_t qoS);
+
+        // Counts the local subscriptions to a topic filter, the other workers are told about the first and the last one
+        void addTopicFilter(const std::string& topicFilter);
+        void removeTopicFilter(const std::string& topicFilter);
+
+        void loadSessions(const std::string& path);
+        void saveSessions(const std::string& path) const;
+
+    private:
+        class EventReceiver;
+        struct Ring;
+        struct WorkerState;
+
+        enum class Type : uint8_t {
+            Publish,
+            Subscribe,
+            Unsubscribe,
+            ClientConnected,
+            Subscriptions,
+            SharedJoin,
+            SharedLeave,
+            SharedDeliver,
+        };
+
+        static constexpr std::size_t maxFields = 4;
+
+        // Fragments spilled for one worker, each with its header
+        struct Overflow {
+            std::deque<std::string> fragments;
+            std::size_t bytes = 0;
+        };
+
+        struct Session {
+            bool cleanSession = true;
+            std::map<std::string, uint8_t> subscriptions; // QoS by topic filter
+        };
+
+        // The topic filters subscribed to on another worker
+        struct RemoteFilters {
+            std::set<std::string, std::less<>> literal;
+            std::set<std::string, std::less<>> wildcard;
+
+            bool matches(std::string_view topic) const;
+        };
+
+        Ring& ring(std::size_t from, std::size_t to) const;
+        WorkerState& state(std::size_t worker) const;
+
+        // Signals the eventfd of worker unless it has been signaled already and not woken up since
+        void wake(std::size_t worker);
+
+        // Run on the event loop when the eventfd of this worker is signaled and when a worker has exited
+        void wokenUp();
+        void reap();
+
+        // Moves spilled fragments into the rings and publishes all messages forwarded by the other workers to the local broker
+        std::size_t receive(iot::mqtt::server::broker::Broker& broker);
+
+        void broadcast(Type type, std::initializer_list<std::string_view> fields);
+
+        // Closes a local connection of a client which connected to worker from later and moves its persistent session there
+        void takeOver(std::size_t from,
+                      const std::string& clientId,
+                      int64_t connectTime,
+                      bool cleanSession,
+                      iot::mqtt::server::broker::Broker& broker);
+
+        // Writes a record made of fields, each prefixed by its length, to the ring of worker to or its overflow queue
+        void send(std::size_t to, Type type, uint8_t qoS, bool retain, std::initializer_list<std::string_view> fields);
+        void flush(std::size_t to);
+
+        void process(std::size_t from,
+                     Type type,
+                     uint8_t qoS,
+                     bool retain,
+                     std::string_view record,
+                     iot::mqtt::server::broker::Broker& broker);
+
+        void* memory = nullptr;
+        std::size_t memorySize = 0;
+        std::size_t workerCount = 0;
+        std::size_t workerIndex = 0;
+
+        std::vector<int> eventFds; // by worker
+        std::vector<pid_t> workerPids;
+        int signalFd = -1;
+        std::shared_ptr<iot::mqtt::server::broker::Broker> broker;
+
+        std::vector<Overflow> overflows;          // by receiving worker
+        std::vector<std::string> fragmented;      // the fragments received so far of an incomplete record, by sending worker
+        std::vector<RemoteFilters> remoteFilters; // by sending worker
+
+        std::map<std::string, Session> sessions;              // by client id
+        std::map<std::string, std::size_t> topicFilterCounts; // local clients subscribed to each topic filter
+
+        uint64_t dropped = 0;
+    };
+
+} // namespace mqtt::mqttbroker::lib
+
+#endif // MQTTBROKER_LIB_WORKERFANOUT_H
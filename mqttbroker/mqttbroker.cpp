@@ -18,16 +18,22 @@
 
 #include "MqttModel.h"
 #include "SharedSocketContextFactory.h" // IWYU pragma: keep
+#include "lib/AdmissionControl.h"
+#include "lib/JsonMappingReader.h"
+#include "lib/MappingWorkerPool.h"
 #include "lib/Mqtt.h"
-
-namespace iot::mqtt::packets {
-    class Connect;
-}
+#include "lib/MqttMetrics.h"
+#include "lib/RetainedStore.h"
+#include "lib/SharedSubscriptions.h"
+#include "lib/SysPublisher.h"
+#include "lib/WorkerFanout.h"
 
 #include <core/SNodeC.h>
 #include <core/socket/SocketAddress.h>
+#include <core/timer/Timer.h>
 #include <express/legacy/in/WebApp.h>
 #include <express/tls/in/WebApp.h>
+#include <iot/mqtt/server/broker/Broker.h>
 #include <log/Logger.h>
 #include <net/in/stream/legacy/SocketServer.h> // IWYU pragma: keep
 #include <net/in/stream/tls/SocketServer.h>    // IWYU pragma: keep
@@ -37,24 +43,266 @@ namespace iot::mqtt::packets {
 
 //
 
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <csignal>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+    constexpr std::size_t defaultClientsPageSize = 100;
+    constexpr std::size_t maxClientsPageSize = 1000;
+    constexpr std::size_t maxClientsPageScan = 10000; // slots looked at per request, matching the prefix or not
+
+    std::size_t parseSize(const std::string& value, std::size_t defaultValue) {
+        std::size_t size = defaultValue;
+
+        const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), size);
+        if (ec != std::errc() || ptr != value.data() + value.size()) {
+            size = defaultValue;
+        }
+
+        return size;
+    }
+
+    // One page of the connected clients as json. The cursor is the slot index to continue with and is returned as "next" as long as
+    // slots are left. A client connecting into a slot below the cursor while paging is not part of the remaining pages, as with a
+    // database cursor. The work per request is bounded by the page size and by maxClientsPageScan slots, thus a page filtered by a
+    // prefix may hold fewer clients than the limit while "next" is not null. A large client list is fetched over several requests
+    // without stalling the event loop.
+    std::string getClientsPage(const std::string& cursorParam, const std::string& limitParam, const std::string& clientIdPrefix) {
+        const std::vector<mqtt::mqttbroker::lib::ConnectedClient>& connectedClients =
+            mqtt::mqttbroker::lib::MqttModel::instance().getConnectedClients();
+
+        const std::size_t limit = std::clamp<std::size_t>(parseSize(limitParam, defaultClientsPageSize), 1, maxClientsPageSize);
+        std::size_t slot = std::min(parseSize(cursorParam, 0), connectedClients.size());
+        const std::size_t scanEnd = std::min(connectedClients.size(), slot + maxClientsPageScan);
+
+        nlohmann::json clients = nlohmann::json::array();
+
+        for (; slot < scanEnd && clients.size() < limit; ++slot) {
+            const mqtt::mqttbroker::lib::ConnectedClient& connectedClient = connectedClients[slot];
+
+            if (connectedClient.mqtt != nullptr && connectedClient.clientId.starts_with(clientIdPrefix)) {
+                const std::chrono::seconds connectedSince =
+                    std::chrono::duration_cast<std::chrono::seconds>(connectedClient.connectTime.time_since_epoch());
+
+                clients.push_back({{"client_id", connectedClient.clientId},
+                                   {"local_address", connectedClient.localAddress},
+                                   {"remote_address", connectedClient.remoteAddress},
+                                   {"connected_since", connectedSince.count()},
+                                   {"keep_alive", connectedClient.keepAlive},
+                                   {"protocol", connectedClient.protocol},
+                                   {"level", connectedClient.level}});
+            }
+        }
+
+        nlohmann::json page = {{"clients", clients}, {"total", mqtt::mqttbroker::lib::MqttModel::instance().getConnectedClientCount()}};
+        page["next"] = slot < connectedClients.size() ? nlohmann::json(slot) : nlohmann::json(nullptr);
+
+        return page.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+    }
+
+    std::string getMetrics() {
+        std::string metrics = "# HELP mqtt_connected_clients Connected clients per listener.\n"
+                              "# TYPE mqtt_connected_clients gauge\n";
+
+        for (const auto& [listener, count] : mqtt::mqttbroker::lib::MqttModel::instance().getConnectedClientCountByListener()) {
+            metrics += "mqtt_connected_clients{listener=\"" + listener + "\"} " + std::to_string(count) + "\n";
+        }
+
+        metrics += "# HELP mqtt_pending_connections Connections which have not sent their CONNECT yet.\n"
+                   "# TYPE mqtt_pending_connections gauge\n"
+                   "mqtt_pending_connections " +
+                   std::to_string(mqtt::mqttbroker::lib::AdmissionControl::instance().getPendingCount()) + "\n";
+
+        const std::vector<std::size_t> queueDepths = mqtt::mqttbroker::lib::MappingWorkerPool::instance().getQueueDepths();
+        if (!queueDepths.empty()) {
+            metrics += "# HELP mqtt_mapping_queue_depth Publishes queued for a mapping worker.\n"
+                       "# TYPE mqtt_mapping_queue_depth gauge\n";
+
+            for (std::size_t worker = 0; worker < queueDepths.size(); ++worker) {
+                metrics +=
+                    "mqtt_mapping_queue_depth{worker=\"" + std::to_string(worker) + "\"} " + std::to_string(queueDepths[worker]) + "\n";
+            }
+        }
+
+        return metrics + mqtt::lib::MqttMetrics::instance().toPrometheus();
+    }
+
+    // The worker processes have to be forked before core::SNodeC::init() sets up the event loop, thus --workers is taken from argv
+    // directly. It is registered with utils::Config nevertheless, so that it is accepted and listed by --help, and a value read from
+    // a configuration file only is rejected after parsing.
+    std::size_t getWorkerCount(int argc, char* argv[]) {
+        std::string workers;
+
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+                workers = argv[i + 1];
+            } else if (std::strncmp(argv[i], "--workers=", 10) == 0) {
+                workers = argv[i] + 10;
+            }
+        }
+
+        return std::max<std::size_t>(parseSize(workers, 1), 1);
+    }
+
+    // Forks workerCount - 1 worker processes and returns the index of the calling process, 0 for the initial one, which gets the pids
+    // of the others
+    std::size_t forkWorkers(std::size_t workerCount, std::vector<pid_t>& workerPids) {
+        std::size_t workerIndex = 0;
+
+        for (std::size_t i = 1; i < workerCount && workerIndex == 0; ++i) {
+            const pid_t pid = fork();
+
+            if (pid == 0) {
+                prctl(PR_SET_PDEATHSIG, SIGTERM);
+                workerIndex = i;
+                workerPids.clear();
+            } else if (pid > 0) {
+                workerPids.push_back(pid);
+            } else {
+                PLOG(ERROR) << "fork worker " << i;
+                break;
+            }
+        }
+
+        return workerIndex;
+    }
+
+} // namespace
 
 int main(int argc, char* argv[]) {
     std::string mappingFilePath;
     utils::Config::add_option("--mqtt-mapping-file", mappingFilePath, "MQTT mapping file (json format) for integration", false, "[path]");
 
+    int mappingReloadInterval = 0;
+    utils::Config::add_option("--mqtt-mapping-reload-interval",
+                              mappingReloadInterval,
+                              "Interval in seconds for reloading a changed mapping file (0 disables reloading)",
+                              false,
+                              "[seconds]");
+
     std::string sessionStore;
     utils::Config::add_option("--mqtt-session-store", sessionStore, "Path to file for the persistent session store", false, "[path]");
 
+    std::string retainedStore;
+    utils::Config::add_option(
+        "--mqtt-retained-store", retainedStore, "Path to file for the durable store of retained messages", false, "[path]");
+
+    int sysInterval = 10;
+    utils::Config::add_option(
+        "--mqtt-sys-interval", sysInterval, "Interval in seconds for publishing the $SYS topics (0 disables them)", false, "[seconds]");
+
+    int mappingWorkers = 0;
+    utils::Config::add_option("--mqtt-mapping-workers",
+                              mappingWorkers,
+                              "Number of worker threads for mapping received messages (0 maps on the event loop)",
+                              false,
+                              "[count]");
+
+    int mappingQueueMessages = 10000;
+    utils::Config::add_option(
+        "--mqtt-mapping-queue-messages", mappingQueueMessages, "Maximum number of publishes queued per mapping worker", false, "[count]");
+
+    int mappingQueueBytes = 64 * 1024 * 1024;
+    utils::Config::add_option(
+        "--mqtt-mapping-queue-bytes", mappingQueueBytes, "Maximum number of bytes queued per mapping worker", false, "[bytes]");
+
+    std::string mappingQueuePolicy = "drop-oldest";
+    utils::Config::add_option("--mqtt-mapping-queue-policy",
+                              mappingQueuePolicy,
+                              "Policy for a full mapping queue: drop-oldest (QoS 0 publishes) or drop-newest",
+                              false,
+                              "[policy]");
+
+    int admissionRate = 0;
+    utils::Config::add_option("--mqtt-admission-rate",
+                              admissionRate,
+                              "Connections accepted per second and listener (0 accepts all connections)",
+                              false,
+                              "[connections/s]");
+
+    int admissionBurst = 100;
+    utils::Config::add_option(
+        "--mqtt-admission-burst", admissionBurst, "Connections accepted per listener at once on top of the rate", false, "[count]");
+
+    int maxPendingConnections = 0;
+    utils::Config::add_option("--mqtt-max-pending-connections",
+                              maxPendingConnections,
+                              "Maximum number of connections waiting for their CONNECT (0 is unlimited)",
+                              false,
+                              "[count]");
+
+    int workers = 1;
+    utils::Config::add_option(
+        "--workers", workers, "Number of broker processes sharing the listening ports (command line only)", false, "[count]");
+
+    const std::size_t workerCount = getWorkerCount(argc, argv);
+    std::size_t workerIndex = 0;
+    std::vector<pid_t> workerPids;
+
+    if (workerCount > 1 && mqtt::mqttbroker::lib::WorkerFanout::instance().create(workerCount)) {
+        workerIndex = forkWorkers(workerCount, workerPids);
+    }
+
     core::SNodeC::init(argc, argv);
 
+    if (mappingQueuePolicy != "drop-oldest" && mappingQueuePolicy != "drop-newest") {
+        LOG(ERROR) << "Unknown --mqtt-mapping-queue-policy " << mappingQueuePolicy << ", expected drop-oldest or drop-newest";
+        return EXIT_FAILURE;
+    }
+
+    if (static_cast<std::size_t>(std::max(workers, 1)) != workerCount) {
+        LOG(ERROR) << "--workers " << workers << " is only read from the command line, " << workerCount << " workers are running";
+        return EXIT_FAILURE;
+    }
+
+    mqtt::mqttbroker::lib::WorkerFanout::instance().attach(
+        workerIndex, workerPids, iot::mqtt::server::broker::Broker::instance(SUBSCRIBTION_MAX_QOS));
+
+    if (workerIndex > 0 && !sessionStore.empty()) {
+        sessionStore += "." + std::to_string(workerIndex);
+    }
+    if (workerIndex > 0 && !retainedStore.empty()) {
+        retainedStore += "." + std::to_string(workerIndex);
+    }
+
+    const std::string workerSessions = !sessionStore.empty() ? sessionStore + ".subscriptions" : "";
+    if (mqtt::mqttbroker::lib::WorkerFanout::instance().isActive() && !workerSessions.empty()) {
+        mqtt::mqttbroker::lib::WorkerFanout::instance().loadSessions(workerSessions);
+    }
+
+    const std::string sharedSessions = !sessionStore.empty() ? sessionStore + ".shared" : "";
+    if (!sharedSessions.empty()) {
+        mqtt::mqttbroker::lib::SharedSubscriptions::instance().loadSessions(sharedSessions);
+    }
+
     setenv("MQTT_MAPPING_FILE", mappingFilePath.data(), 0);
     setenv("MQTT_SESSION_STORE", sessionStore.data(), 0);
 
+    mqtt::mqttbroker::lib::AdmissionControl::instance().configure(
+        admissionRate, admissionBurst, static_cast<std::size_t>(std::max(maxPendingConnections, 0)));
+
     using MQTTLegacyInServer = net::in::stream::legacy::SocketServer<mqtt::mqttbroker::SharedSocketContextFactory>;
 
     MQTTLegacyInServer mqttLegacyInServer("legacyin");
 
+    if (workerCount > 1) {
+        mqttLegacyInServer.getConfig().setReusePort();
+    }
+
     mqttLegacyInServer.listen([mqttLegacyInServer](const MQTTLegacyInServer::SocketAddress& socketAddress, int errnum) mutable -> void {
         if (errnum < 0) {
             PLOG(ERROR) << "listening on " << socketAddress.toString();
@@ -75,6 +323,10 @@ int main(int argc, char* argv[]) {
 
     //    mqttTLSInServer.addSniCerts(sniCerts);
 
+    if (workerCount > 1) {
+        mqttTLSInServer.getConfig().setReusePort();
+    }
+
     mqttTLSInServer.listen([mqttTLSInServer](const MQTTTLSInServer::SocketAddress& socketAddress, int errnum) mutable -> void {
         if (errnum < 0) {
             PLOG(ERROR) << "listening on " << socketAddress.toString();
@@ -89,15 +341,64 @@ int main(int argc, char* argv[]) {
 
     MQTTLegacyUnServer mqttLegacyUnServer("legacyun");
 
-    mqttLegacyUnServer.listen([mqttLegacyUnServer](const MQTTLegacyUnServer::SocketAddress& socketAddress, int errnum) mutable -> void {
-        if (errnum < 0) {
-            PLOG(ERROR) << "listening on " << socketAddress.toString();
-        } else if (errnum > 0) {
-            PLOG(ERROR) << "listening on " << socketAddress.toString();
-        } else {
-            VLOG(0) << mqttLegacyUnServer.getConfig().getName() << " listening on " << socketAddress.toString();
-        }
-    });
+    // A unix domain socket can not be shared, it is served by the initial worker only
+    if (workerIndex == 0) {
+        mqttLegacyUnServer.listen([mqttLegacyUnServer](const MQTTLegacyUnServer::SocketAddress& socketAddress, int errnum) mutable -> void {
+            if (errnum < 0) {
+                PLOG(ERROR) << "listening on " << socketAddress.toString();
+            } else if (errnum > 0) {
+                PLOG(ERROR) << "listening on " << socketAddress.toString();
+            } else {
+                VLOG(0) << mqttLegacyUnServer.getConfig().getName() << " listening on " << socketAddress.toString();
+            }
+        });
+    }
+
+    core::timer::Timer eventLoopLagTimer = core::timer::Timer::intervalTimer(
+        [lastTick = std::chrono::steady_clock::now()]([[maybe_unused]] const std::function<void()>& stop) mutable -> void {
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+            mqtt::lib::MqttMetrics::instance().updateRates(std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastTick),
+                                                           std::chrono::seconds(1));
+            lastTick = now;
+        },
+        1);
+
+    mqtt::mqttbroker::lib::MappingWorkerPool::instance().setQueueLimits(
+        static_cast<std::size_t>(std::max(mappingQueueMessages, 1)),
+        static_cast<std::size_t>(std::max(mappingQueueBytes, 1)),
+        mappingQueuePolicy == "drop-newest" ? mqtt::mqttbroker::lib::MappingWorkerPool::OverflowPolicy::DropNewest
+                                            : mqtt::mqttbroker::lib::MappingWorkerPool::OverflowPolicy::DropOldestQoS0);
+
+    if (mappingReloadInterval > 0 && !mappingFilePath.empty()) {
+        core::timer::Timer mappingReloadTimer = core::timer::Timer::intervalTimer(
+            [mappingFilePath]([[maybe_unused]] const std::function<void()>& stop) -> void {
+                mqtt::lib::JsonMappingReader::readMappingFromFile(mappingFilePath);
+            },
+            mappingReloadInterval);
+    }
+
+    if (mappingWorkers > 0) {
+        mqtt::mqttbroker::lib::MappingWorkerPool::instance().start(static_cast<std::size_t>(mappingWorkers));
+    }
+
+    if (!retainedStore.empty() && mqtt::mqttbroker::lib::RetainedStore::instance().open(retainedStore)) {
+        core::timer::Timer retainedStoreSyncTimer = core::timer::Timer::intervalTimer(
+            []([[maybe_unused]] const std::function<void()>& stop) -> void {
+                mqtt::mqttbroker::lib::RetainedStore::instance().sync();
+            },
+            1);
+    }
+
+    if (sysInterval > 0) {
+        core::timer::Timer sysTimer = core::timer::Timer::intervalTimer(
+            [sysPublisher = std::make_shared<mqtt::mqttbroker::lib::SysPublisher>(
+                 iot::mqtt::server::broker::Broker::instance(SUBSCRIBTION_MAX_QOS))]([[maybe_unused]] const std::function<void()>& stop)
+                -> void {
+                sysPublisher->publish();
+            },
+            sysInterval);
+    }
 
     express::tls::in::WebApp mqttTLSWebView("mqtttlswebview");
 
@@ -106,8 +407,8 @@ int main(int argc, char* argv[]) {
     });
 
     mqttTLSWebView.get("/clients", [] APPLICATION(req, res) {
-        const std::map<mqtt::mqttbroker::lib::Mqtt*, iot::mqtt::packets::Connect>& connectionList =
-            mqtt::mqttbroker::lib::MqttModel::instance().getConnectedClinets();
+        const std::vector<mqtt::mqttbroker::lib::ConnectedClient>& connectedClients =
+            mqtt::mqttbroker::lib::MqttModel::instance().getConnectedClients();
 
         std::string responseString = "<html>"
                                      "  <head>"
@@ -118,9 +419,11 @@ int main(int argc, char* argv[]) {
                                      "    <table>"
                                      "      <tr><th>ClientId</th><th>Locale Address</th><th>Remote Address</th></tr>";
 
-        for (const auto& [mqtt, connectPacket] : connectionList) {
-            responseString += "<tr><td>" + mqtt->getClientId() + "</td><td>" + mqtt->getSocketConnection()->getLocalAddress().toString() +
-                              "</td><td>" + mqtt->getSocketConnection()->getRemoteAddress().toString() + "</td></tr>";
+        for (const mqtt::mqttbroker::lib::ConnectedClient& connectedClient : connectedClients) {
+            if (connectedClient.mqtt != nullptr) {
+                responseString += "<tr><td>" + connectedClient.clientId + "</td><td>" + connectedClient.localAddress + "</td><td>" +
+                                  connectedClient.remoteAddress + "</td></tr>";
+            }
         }
 
         responseString += "    </table>"
@@ -130,6 +433,16 @@ int main(int argc, char* argv[]) {
         res.send(responseString);
     });
 
+    mqttTLSWebView.get("/metrics", [] APPLICATION(req, res) {
+        res.set("Content-Type", "text/plain; version=0.0.4");
+        res.send(getMetrics());
+    });
+
+    mqttTLSWebView.get("/api/clients", [] APPLICATION(req, res) {
+        res.set("Content-Type", "application/json");
+        res.send(getClientsPage(req.query("cursor"), req.query("limit"), req.query("prefix")));
+    });
+
     mqttTLSWebView.get("/ws/", [] APPLICATION(req, res) -> void {
         std::string uri = req.originalUrl;
 
@@ -154,15 +467,18 @@ int main(int argc, char* argv[]) {
         }
     });
 
-    mqttTLSWebView.listen([](const express::tls::in::WebApp::SocketAddress& socketAddress, int errnum) mutable -> void {
-        if (errnum < 0) {
-            PLOG(ERROR) << "listening on " << socketAddress.toString();
-        } else if (errnum > 0) {
-            PLOG(ERROR) << "listening on " << socketAddress.toString();
-        } else {
-            VLOG(0) << "MqttWebFrontend listening on " << socketAddress.toString();
-        }
-    });
+    // Served by the initial worker only, so that the clients and metrics shown always come from the same worker
+    if (workerIndex == 0) {
+        mqttTLSWebView.listen([](const express::tls::in::WebApp::SocketAddress& socketAddress, int errnum) mutable -> void {
+            if (errnum < 0) {
+                PLOG(ERROR) << "listening on " << socketAddress.toString();
+            } else if (errnum > 0) {
+                PLOG(ERROR) << "listening on " << socketAddress.toString();
+            } else {
+                VLOG(0) << "MqttWebFrontend listening on " << socketAddress.toString();
+            }
+        });
+    }
 
     express::legacy::in::WebApp mqttLegacyWebView("mqttlegacywebview");
 
@@ -171,8 +487,8 @@ int main(int argc, char* argv[]) {
     });
 
     mqttLegacyWebView.get("/clients", [] APPLICATION(req, res) {
-        const std::map<mqtt::mqttbroker::lib::Mqtt*, iot::mqtt::packets::Connect>& connectionList =
-            mqtt::mqttbroker::lib::MqttModel::instance().getConnectedClinets();
+        const std::vector<mqtt::mqttbroker::lib::ConnectedClient>& connectedClients =
+            mqtt::mqttbroker::lib::MqttModel::instance().getConnectedClients();
 
         std::string responseString = "<html>"
                                      "  <head>"
@@ -183,9 +499,11 @@ int main(int argc, char* argv[]) {
                                      "    <table>"
                                      "      <tr><th>ClientId</th><th>Locale Address</th><th>Remote Address</th></tr>";
 
-        for (const auto& [mqtt, connectPacket] : connectionList) {
-            responseString += "<tr><td>" + mqtt->getClientId() + "</td><td>" + mqtt->getSocketConnection()->getLocalAddress().toString() +
-                              "</td><td>" + mqtt->getSocketConnection()->getRemoteAddress().toString() + "</td></tr>";
+        for (const mqtt::mqttbroker::lib::ConnectedClient& connectedClient : connectedClients) {
+            if (connectedClient.mqtt != nullptr) {
+                responseString += "<tr><td>" + connectedClient.clientId + "</td><td>" + connectedClient.localAddress + "</td><td>" +
+                                  connectedClient.remoteAddress + "</td></tr>";
+            }
         }
 
         responseString += "    </table>"
@@ -195,6 +513,16 @@ int main(int argc, char* argv[]) {
         res.send(responseString);
     });
 
+    mqttLegacyWebView.get("/metrics", [] APPLICATION(req, res) {
+        res.set("Content-Type", "text/plain; version=0.0.4");
+        res.send(getMetrics());
+    });
+
+    mqttLegacyWebView.get("/api/clients", [] APPLICATION(req, res) {
+        res.set("Content-Type", "application/json");
+        res.send(getClientsPage(req.query("cursor"), req.query("limit"), req.query("prefix")));
+    });
+
     mqttLegacyWebView.get("/ws/", [] APPLICATION(req, res) -> void {
         std::string uri = req.originalUrl;
 
@@ -243,15 +571,29 @@ int main(int argc, char* argv[]) {
         }
     });
 
-    mqttLegacyWebView.listen([](const express::legacy::in::WebApp::SocketAddress& socketAddress, int errnum) mutable -> void {
-        if (errnum < 0) {
-            PLOG(ERROR) << "listening on " << socketAddress.toString();
-        } else if (errnum > 0) {
-            PLOG(ERROR) << "listening on " << socketAddress.toString();
-        } else {
-            VLOG(0) << "MqttWebFrontend listening on " << socketAddress.toString();
-        }
-    });
-
-    return core::SNodeC::start();
+    // Served by the initial worker only, as the TLS web view
+    if (workerIndex == 0) {
+        mqttLegacyWebView.listen([](const express::legacy::in::WebApp::SocketAddress& socketAddress, int errnum) mutable -> void {
+            if (errnum < 0) {
+                PLOG(ERROR) << "listening on " << socketAddress.toString();
+            } else if (errnum > 0) {
+                PLOG(ERROR) << "listening on " << socketAddress.toString();
+            } else {
+                VLOG(0) << "MqttWebFrontend listening on " << socketAddress.toString();
+            }
+        });
+    }
+
+    const int ret = core::SNodeC::start();
+
+    mqtt::mqttbroker::lib::RetainedStore::instance().close();
+
+    if (mqtt::mqttbroker::lib::WorkerFanout::instance().isActive() && !workerSessions.empty()) {
+        mqtt::mqttbroker::lib::WorkerFanout::instance().saveSessions(workerSessions);
+    }
+    if (!sharedSessions.empty()) {
+        mqtt::mqttbroker::lib::SharedSubscriptions::instance().saveSessions(sharedSessions);
+    }
+
+    return ret;
 }
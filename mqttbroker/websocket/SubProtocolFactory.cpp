@@ -36,11 +36,7 @@ namespace mqtt::mqttbroker::websocket {
         char* mappingFile = getenv("MQTT_MAPPING_FILE");
 
         if (mappingFile != nullptr) {
-            nlohmann::json mappingJson = mqtt::lib::JsonMappingReader::readMappingFromFile(mappingFile);
-
-            if (!mappingJson.empty()) {
-                jsonMapping = mappingJson["mapping"];
-            }
+            mqtt::lib::JsonMappingReader::readMappingFromFile(mappingFile);
         }
     }
 
@@ -48,7 +44,9 @@ namespace mqtt::mqttbroker::websocket {
         return new iot::mqtt::server::SubProtocol(
             subProtocolContext,
             getName(),
-            new mqtt::mqttbroker::lib::Mqtt(iot::mqtt::server::broker::Broker::instance(SUBSCRIBTION_MAX_QOS), jsonMapping));
+            new mqtt::mqttbroker::lib::Mqtt(iot::mqtt::server::broker::Broker::instance(SUBSCRIBTION_MAX_QOS),
+                                            mqtt::lib::JsonMappingReader::getMappingJson(),
+                                            mqtt::lib::JsonMappingReader::getMappedPublishCounters()));
     }
 
 } // namespace mqtt::mqttbroker::websocket
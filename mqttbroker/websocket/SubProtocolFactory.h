@@ -28,9 +28,7 @@ namespace web::websocket {
 
 //
 
-#include <nlohmann/json.hpp>
 #include <string>
-// IWYU pragma: no_include <nlohmann/json_fwd.hpp>
 
 namespace mqtt::mqttbroker::websocket {
 
@@ -40,8 +38,6 @@ namespace mqtt::mqttbroker::websocket {
 
     private:
         iot::mqtt::server::SubProtocol* create(web::websocket::SubProtocolContext* subProtocolContext) override;
-
-        nlohmann::json jsonMapping;
     };
 
 } // namespace mqtt::mqttbroker::websocket
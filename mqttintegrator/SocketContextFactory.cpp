@@ -34,21 +34,20 @@ namespace core::socket {
 
 namespace mqtt::mqttintegrator {
 
-    SocketContextFactory::SocketContextFactory() {
+    SocketContextFactory::SocketContextFactory()
+        : connection(mqtt::lib::JsonMappingReader::getConnectionJson()) {
         char* mappingFile = getenv("MQTT_MAPPING_FILE");
 
         if (mappingFile != nullptr) {
-            nlohmann::json mappingJson = mqtt::lib::JsonMappingReader::readMappingFromFile(mappingFile);
-
-            if (!mappingJson.empty()) {
-                connection = mappingJson["connection"];
-                jsonMapping = mappingJson["mapping"];
-            }
+            mqtt::lib::JsonMappingReader::readMappingFromFile(mappingFile);
         }
     }
 
     core::socket::SocketContext* SocketContextFactory::create(core::socket::SocketConnection* socketConnection) {
-        return new iot::mqtt::SocketContext(socketConnection, new mqtt::mqttintegrator::lib::Mqtt(connection, jsonMapping));
+        return new iot::mqtt::SocketContext(socketConnection,
+                                            new mqtt::mqttintegrator::lib::Mqtt(connection,
+                                                                                mqtt::lib::JsonMappingReader::getMappingJson(),
+                                                                                mqtt::lib::JsonMappingReader::getMappedPublishCounters()));
     }
 
 } // namespace mqtt::mqttintegrator
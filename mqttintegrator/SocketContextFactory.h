@@ -40,8 +40,7 @@ namespace mqtt::mqttintegrator {
         core::socket::SocketContext* create(core::socket::SocketConnection* socketConnection) final;
 
     private:
-        nlohmann::json connection;
-        nlohmann::json jsonMapping;
+        const nlohmann::json& connection;
     };
 
 } // namespace mqtt::mqttintegrator
@@ -32,8 +32,10 @@
 
 namespace mqtt::mqttintegrator::lib {
 
-    Mqtt::Mqtt(const nlohmann::json& connectionJson, const nlohmann::json& mappingJson)
-        : mqtt::lib::MqttMapper(mappingJson)
+    Mqtt::Mqtt(const nlohmann::json& connectionJson,
+               const std::shared_ptr<const nlohmann::json>& mappingJson,
+               const std::shared_ptr<const mqtt::lib::MqttMetrics::MappedPublishCounters>& mappedPublishCounters)
+        : mqtt::lib::MqttMapper(mappingJson, mappedPublishCounters)
         , connectionJson(connectionJson)
         , keepAlive(connectionJson["keep_alive"])
         , clientId(connectionJson["client_id"])
@@ -43,7 +45,8 @@ namespace mqtt::mqttintegrator::lib {
         , willQoS(connectionJson["will_qos"])
         , willRetain(connectionJson["will_retain"])
         , username(connectionJson["username"])
-        , password(connectionJson["password"]) {
+        , password(connectionJson["password"])
+        , shareGroup(connectionJson["share_group"]) {
         LOG(TRACE) << "Keep Alive: " << keepAlive;
         LOG(TRACE) << "Client Id: " << clientId;
         LOG(TRACE) << "Clean Session: " << cleanSession;
@@ -53,6 +56,7 @@ namespace mqtt::mqttintegrator::lib {
         LOG(TRACE) << "Will Retain " << willRetain;
         LOG(TRACE) << "Username: " << username;
         LOG(TRACE) << "Password: " << password;
+        LOG(TRACE) << "Share Group: " << shareGroup;
     }
 
     void Mqtt::onConnected() {
@@ -74,6 +78,13 @@ namespace mqtt::mqttintegrator::lib {
 
             std::list<iot::mqtt::Topic> topicList = MqttMapper::extractTopics();
 
+            // Integrators of the same share group split the publishes of the topics among each other
+            if (!shareGroup.empty()) {
+                for (iot::mqtt::Topic& topic : topicList) {
+                    topic = iot::mqtt::Topic("$share/" + shareGroup + "/" + topic.getName(), topic.getQoS());
+                }
+            }
+
             for (const iot::mqtt::Topic& topic : topicList) {
                 LOG(INFO) << "Subscribe Topic: " << topic.getName() << ", qoS: " << static_cast<uint16_t>(topic.getQoS());
             }
@@ -86,8 +97,8 @@ namespace mqtt::mqttintegrator::lib {
         publishMappings(publish);
     }
 
-    void Mqtt::publishMapping(const std::string& topic, const std::string& message, uint8_t qoS, bool retain) {
-        sendPublish(topic, message, qoS, retain);
+    void Mqtt::publishMapping(const std::string& topic, const mqtt::lib::Payload& message, uint8_t qoS, bool retain) {
+        sendPublish(topic, message.str(), qoS, retain);
     }
 
 } // namespace mqtt::mqttintegrator::lib
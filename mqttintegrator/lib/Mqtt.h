@@ -30,6 +30,7 @@ namespace iot::mqtt::packets {
 
 //
 
+#include <memory>
 #include <string>
 
 namespace mqtt::mqttintegrator::lib {
@@ -38,7 +39,9 @@ namespace mqtt::mqttintegrator::lib {
         : public iot::mqtt::client::Mqtt
         , public mqtt::lib::MqttMapper {
     public:
-        explicit Mqtt(const nlohmann::json& connectionJson, const nlohmann::json& mappingJson);
+        explicit Mqtt(const nlohmann::json& connectionJson,
+                      const std::shared_ptr<const nlohmann::json>& mappingJson,
+                      const std::shared_ptr<const mqtt::lib::MqttMetrics::MappedPublishCounters>& mappedPublishCounters);
 
     private:
         void onConnected() final;
@@ -47,7 +50,7 @@ namespace mqtt::mqttintegrator::lib {
         void onConnack(const iot::mqtt::packets::Connack& connack) final;
         void onPublish(const iot::mqtt::packets::Publish& publish) final;
 
-        void publishMapping(const std::string& topic, const std::string& message, uint8_t qoS, bool retain) final;
+        void publishMapping(const std::string& topic, const mqtt::lib::Payload& message, uint8_t qoS, bool retain) final;
 
         const nlohmann::json& connectionJson;
 
@@ -60,6 +63,7 @@ namespace mqtt::mqttintegrator::lib {
         bool willRetain;
         std::string username;
         std::string password;
+        std::string shareGroup;
     };
 
 } // namespace mqtt::mqttintegrator::lib
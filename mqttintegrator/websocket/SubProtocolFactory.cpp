@@ -30,22 +30,22 @@
 namespace mqtt::mqttintegrator::websocket {
 
     SubProtocolFactory::SubProtocolFactory(const std::string& name)
-        : web::websocket::SubProtocolFactory<iot::mqtt::client::SubProtocol>::SubProtocolFactory(name) {
+        : web::websocket::SubProtocolFactory<iot::mqtt::client::SubProtocol>::SubProtocolFactory(name)
+        , connection(mqtt::lib::JsonMappingReader::getConnectionJson()) {
         char* mappingFile = getenv("MQTT_MAPPING_FILE");
 
         if (mappingFile != nullptr) {
-            nlohmann::json mappingJson = mqtt::lib::JsonMappingReader::readMappingFromFile(mappingFile);
-
-            if (!mappingJson.empty()) {
-                connection = mappingJson["connection"];
-                jsonMapping = mappingJson["mapping"];
-            }
+            mqtt::lib::JsonMappingReader::readMappingFromFile(mappingFile);
         }
     }
 
     iot::mqtt::client::SubProtocol* SubProtocolFactory::create(web::websocket::SubProtocolContext* subProtocolContext) {
         return new iot::mqtt::client::SubProtocol(
-            subProtocolContext, getName(), new mqtt::mqttintegrator::lib::Mqtt(connection, jsonMapping));
+            subProtocolContext,
+            getName(),
+            new mqtt::mqttintegrator::lib::Mqtt(connection,
+                                                mqtt::lib::JsonMappingReader::getMappingJson(),
+                                                mqtt::lib::JsonMappingReader::getMappedPublishCounters()));
     }
 
 } // namespace mqtt::mqttintegrator::websocket
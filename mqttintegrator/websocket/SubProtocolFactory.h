@@ -41,8 +41,7 @@ namespace mqtt::mqttintegrator::websocket {
     private:
         iot::mqtt::client::SubProtocol* create(web::websocket::SubProtocolContext* subProtocolContext) override;
 
-        nlohmann::json connection;
-        nlohmann::json jsonMapping;
+        const nlohmann::json& connection;
     };
 
 } // namespace mqtt::mqttintegrator::websocket